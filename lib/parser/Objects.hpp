@@ -7,6 +7,7 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <string>
 
 
 namespace parser
@@ -51,13 +52,24 @@ namespace parser
 			Plane,
 			Triangle,
 			Box,
-			Cone
+			Cone,
+			Instance
 		};
 
 		Type type;
 		glm::vec3 v1, v2, v3;
 		float s1 = 0, s2 = 0;
 		Attributes attributes;
+
+		/// Instances: index into Parser::meshes of the geometry they place
+		int mesh = -1;
+	};
+
+	/// Geometry declared once with #declare and placed any number of times with object { }
+	struct Mesh
+	{
+		std::string name;
+		std::vector<Object> triangles;
 	};
 
 	struct Camera
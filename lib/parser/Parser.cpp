@@ -76,6 +76,14 @@ namespace parser
 			{
 				objects.push_back(ParsePlane(tokens));
 			}
+			else if (token == "#")
+			{
+				ParseDeclare(tokens);
+			}
+			else if (token == "object")
+			{
+				objects.push_back(ParseInstance(tokens));
+			}
 			else
 			{
 				throw parse_error("unexpected top-level object", token);
@@ -354,4 +362,72 @@ namespace parser
 		return c;
 	}
 
+	Mesh Parser::ParseMesh(TokenStream & tokens)
+	{
+		Mesh m;
+
+		tokens.require("{");
+
+		while (! tokens.empty())
+		{
+			string token = tokens.pop();
+
+			if (token == "triangle")
+				m.triangles.push_back(ParseTriangle(tokens));
+			else if (token == "}")
+				break;
+			else
+				throw parse_error("unexpected mesh contents", token);
+		}
+
+		return m;
+	}
+
+	void Parser::ParseDeclare(TokenStream & tokens)
+	{
+		tokens.require("declare");
+		const string name = tokens.pop();
+		tokens.require("=");
+
+		const string type = tokens.pop();
+
+		if (type != "mesh")
+		{
+			throw parse_error("unsupported declaration type", type);
+		}
+
+		Mesh m = ParseMesh(tokens);
+		m.name = name;
+
+		if (m.triangles.empty())
+		{
+			throw parse_error("empty mesh", name);
+		}
+
+		// A later declaration with the same name replaces the earlier one for any objects that follow
+		meshIndices[name] = (int) meshes.size();
+		meshes.push_back(m);
+	}
+
+	Object Parser::ParseInstance(TokenStream & tokens) const
+	{
+		Object i;
+		i.type = Object::Type::Instance;
+
+		tokens.require("{");
+		const string name = tokens.pop();
+
+		std::map<std::string, int>::const_iterator it = meshIndices.find(name);
+
+		if (it == meshIndices.end())
+		{
+			throw parse_error("undeclared identifier", name);
+		}
+
+		i.mesh = it->second;
+		i.attributes = ParseAttributes(tokens);
+
+		return i;
+	}
+
 }
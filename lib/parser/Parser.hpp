@@ -8,6 +8,7 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include <string>
+#include <map>
 
 #include "Objects.hpp"
 #include "TokenStream.hpp"
@@ -17,7 +18,7 @@ namespace parser
 {
 
 	/// Takes a TokenStream and parses the entire file, filling the
-	/// camera, lights, and objects fields with the scene information.
+	/// camera, lights, meshes, and objects fields with the scene information.
 	///
 	/// Any malformed or unexpected contents in the .pov file is likely
 	/// to throw an exception.
@@ -32,6 +33,7 @@ namespace parser
 		Camera camera;
 		std::vector<Light> lights;
 		std::vector<Object> objects;
+		std::vector<Mesh> meshes;
 
 		static glm::vec3 ParseVector3(TokenStream & tokens);
 		static glm::vec4 ParseVector4(TokenStream & tokens);
@@ -48,6 +50,14 @@ namespace parser
 		static Object ParseTriangle(TokenStream & tokens);
 		static Object ParseBox(TokenStream & tokens);
 		static Object ParseCone(TokenStream & tokens);
+		static Mesh ParseMesh(TokenStream & tokens);
+
+		void ParseDeclare(TokenStream & tokens);
+		Object ParseInstance(TokenStream & tokens) const;
+
+	protected:
+
+		std::map<std::string, int> meshIndices;
 
 	};
 
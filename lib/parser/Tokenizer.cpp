@@ -57,6 +57,11 @@ vector<string> Tokenizer::Tokenize(const string & source)
 			currentToken.push_back(c);
 			tokenType = Token_Alpha;
 		}
+		else if (isdigit(c) && tokenType == Token_Alpha)
+		{
+			// Identifiers such as Bolt2 keep their digits
+			currentToken.push_back(c);
+		}
 		else if (isdigit(c) || c == '.' || c == '-')
 		{
 			// If building an alpha token, end it
@@ -15,6 +15,8 @@
 #include <Objects/Plane.hpp>
 #include <Objects/Triangle.hpp>
 #include <Objects/Box.hpp>
+#include <Objects/Instance.hpp>
+#include <Scene/BvhCache.hpp>
 
 #include <parser/Tokenizer.hpp>
 #include <parser/Parser.hpp>
@@ -25,6 +27,8 @@
 #include <string>
 #include <iomanip>
 #include <stdexcept>
+#include <thread>
+#include <algorithm>
 
 
 void Application::ReadArguments(int argc, char ** argv)
@@ -89,6 +93,13 @@ void Application::PrintUsage()
 		printf("usage: %s %s <file_name> <width> <height> <x> <y> [arguments ...]\n", programName.c_str(), command.c_str());
 		showParamOptions = true;
 	}
+	else if (command == "printbvh")
+	{
+		printf("usage: %s printbvh <file_name> [-stats] [arguments ...]\n", programName.c_str());
+		printf("    -stats prints node counts, depth and leaf size histograms, SAH cost, overlap, memory use, build time,\n");
+		printf("    and the average nodes visited and rays per second for a grid of camera rays, instead of every node\n");
+		showParamOptions = true;
+	}
 	else if (command == "help")
 	{
 		printf("usage: raytracer <command> <file_name> [arguments ...]\n");
@@ -100,6 +111,7 @@ void Application::PrintUsage()
 		printf("        firsthit     print the first object hit for the given pixel\n");
 		printf("        printrays    print all recursively generated rays for the given pixel\n");
 		printf("        pixeltrace   print all recursively generated rays for the given pixel, with fancy formatting\n");
+		printf("        printbvh     print every node of the bvh built with -sds, or statistics about it, its build time and trace speed with -stats\n");
 	}
 	else
 	{
@@ -111,6 +123,20 @@ void Application::PrintUsage()
 		printf("    possible arguments:\n");
 		printf("        -altbrdf    use Cook-Torrance instead of Blinn-Phong BRDF\n");
 		printf("        -normals    display surface normals instead of any shading\n");
+		printf("        -threads=N  render with N threads (0 uses every hardware thread)\n");
+		printf("        -sds        use a bounding volume hierarchy to accelerate ray queries\n");
+		printf("        -sds=T      accelerate ray queries with a bvh (same as -sds), a kdtree or a grid, or none to test every object;\n");
+		printf("                    auto (default) picks none, a grid, an lbvh or a sah bvh from the scene and image size and prints why\n");
+		printf("                    the bvh options below only apply to a bvh, and ask for one when no -sds flag is given\n");
+		printf("        -bvh=M      bvh build method with -sds: median (default), sah, lbvh or sbvh\n");
+		printf("        -leafsize=N maximum number of objects per bvh leaf; sah and sbvh builds stop short of it where a leaf is cheaper\n");
+		printf("        -splitbudget=F extra object references sbvh may add, as a fraction of the object count (default 0.3)\n");
+		printf("        -bvhwidth=N children per bvh node: 2 (default), 4 or 8\n");
+		printf("        -bvhquantize store bvh child bounds in 8 bits per side, relative to the parent's box, halving node memory\n");
+		printf("        -lazybvh    split bvh nodes only when a ray first reaches them (median or sah, width 2)\n");
+		printf("        -bvhcache   keep the built bvh in <scene file>.bvhcache and load it from there next time\n");
+		printf("        -bvhcache=F keep the built bvh in file F\n");
+		printf("        -treelets=N restructure treelets of the built bvh in N passes to lower its SAH cost\n");
 	}
 }
 
@@ -157,7 +183,15 @@ void Application::RunCommands()
 	{
 		ParseExtraParams(3);
 		rayTracer->SetParams(params);
-		RayInfo::PrintTree(scene);
+
+		if (std::find(commandArguments.begin() + 3, commandArguments.end(), "-stats") != commandArguments.end())
+		{
+			RayInfo::PrintTreeStatistics(scene);
+		}
+		else
+		{
+			RayInfo::PrintTree(scene);
+		}
 		return;
 	}
 
@@ -190,8 +224,22 @@ void Application::RunCommands()
 		}
 
 		ParseExtraParams(5);
+
+		if (params.chooseSpatialDataStructure)
+		{
+			std::cout << scene->ChooseSpatialDataStructure(params) << std::endl;
+		}
+
 		rayTracer->SetParams(params);
-		Renderer::Draw(rayTracer);
+
+		if (params.threadCount > 1)
+		{
+			Renderer::DrawThreaded(rayTracer, params.threadCount);
+		}
+		else
+		{
+			Renderer::Draw(rayTracer);
+		}
 
 		return;
 	}
@@ -210,6 +258,13 @@ void Application::RunCommands()
 	const int y = std::stoi(commandArguments[6]);
 
 	ParseExtraParams(7);
+
+	// Chosen as for rendering the whole image, so the pixel is traced as it is rendered
+	if (params.chooseSpatialDataStructure)
+	{
+		scene->ChooseSpatialDataStructure(params);
+	}
+
 	rayTracer->SetParams(params);
 
 	if (command == "pixelray")
@@ -261,6 +316,8 @@ bool StringBeginsWith(const std::string & s, const std::string & prefix, std::st
 
 void Application::ParseExtraParams(size_t const StartIndex)
 {
+	bool bvhOptionGiven = false;
+
 	for (size_t i = StartIndex; i < commandArguments.size(); ++ i)
 	{
 		std::string const & argument = commandArguments[i];
@@ -288,8 +345,125 @@ void Application::ParseExtraParams(size_t const StartIndex)
 		}
 		else if (argument == "-sds")
 		{
+			params.chooseSpatialDataStructure = false;
 			params.useSpatialDataStructure = true;
 		}
+		else if (StringBeginsWith(argument, "-sds=", remainder))
+		{
+			params.chooseSpatialDataStructure = remainder == "auto";
+			params.useSpatialDataStructure = remainder != "auto" && remainder != "none";
+
+			if (remainder == "bvh")
+			{
+				params.spatialDataStructureType = SpatialDataStructureType::BoundingVolumeHierarchy;
+			}
+			else if (remainder == "kdtree")
+			{
+				params.spatialDataStructureType = SpatialDataStructureType::KdTree;
+			}
+			else if (remainder == "grid")
+			{
+				params.spatialDataStructureType = SpatialDataStructureType::Grid;
+			}
+			else if (remainder != "auto" && remainder != "none")
+			{
+				throw std::invalid_argument("Unknown spatial data structure.");
+			}
+		}
+		else if (StringBeginsWith(argument, "-bvh=", remainder))
+		{
+			bvhOptionGiven = true;
+			if (remainder == "median")
+			{
+				params.bvhBuildMethod = BvhBuildMethod::Median;
+			}
+			else if (remainder == "sah")
+			{
+				params.bvhBuildMethod = BvhBuildMethod::SurfaceAreaHeuristic;
+			}
+			else if (remainder == "lbvh")
+			{
+				params.bvhBuildMethod = BvhBuildMethod::Morton;
+			}
+			else if (remainder == "sbvh")
+			{
+				params.bvhBuildMethod = BvhBuildMethod::SpatialSplit;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown bvh build method.");
+			}
+		}
+		else if (StringBeginsWith(argument, "-leafsize=", remainder))
+		{
+			bvhOptionGiven = true;
+			params.bvhLeafSize = std::stoi(remainder);
+		}
+		else if (StringBeginsWith(argument, "-splitbudget=", remainder))
+		{
+			bvhOptionGiven = true;
+			params.spatialSplitBudget = std::stof(remainder);
+
+			if (params.spatialSplitBudget < 0)
+			{
+				throw std::invalid_argument("Spatial split budget must not be negative.");
+			}
+		}
+		else if (argument == "-bvhquantize")
+		{
+			bvhOptionGiven = true;
+			params.quantizeBvh = true;
+		}
+		else if (argument == "-lazybvh")
+		{
+			bvhOptionGiven = true;
+			params.lazyBvhBuild = true;
+		}
+		else if (argument == "-bvhcache" || StringBeginsWith(argument, "-bvhcache=", remainder))
+		{
+			bvhOptionGiven = true;
+			params.bvhCacheFileName = argument == "-bvhcache" ? fileName + ".bvhcache" : remainder;
+			params.sceneFileHash = BvhCache::HashFile(fileName);
+		}
+		else if (StringBeginsWith(argument, "-treelets=", remainder))
+		{
+			bvhOptionGiven = true;
+			params.treeletPasses = std::stoi(remainder);
+		}
+		else if (StringBeginsWith(argument, "-bvhwidth=", remainder))
+		{
+			bvhOptionGiven = true;
+			params.bvhWidth = std::stoi(remainder);
+
+			if (params.bvhWidth != 2 && params.bvhWidth != 4 && params.bvhWidth != 8)
+			{
+				throw std::invalid_argument("Unsupported bvh width.");
+			}
+		}
+		else if (StringBeginsWith(argument, "-threads=", remainder))
+		{
+			params.threadCount = std::stoi(remainder);
+
+			if (params.threadCount <= 0)
+			{
+				params.threadCount = glm::max((int) std::thread::hardware_concurrency(), 1);
+			}
+		}
+	}
+
+	// Options only a bvh understands ask for one, unless a flag already picked the structure
+	if (params.chooseSpatialDataStructure && bvhOptionGiven)
+	{
+		params.chooseSpatialDataStructure = false;
+		params.useSpatialDataStructure = true;
+		params.spatialDataStructureType = SpatialDataStructureType::BoundingVolumeHierarchy;
+	}
+
+	// A lazily built tree is never complete, so it can't be restructured, collapsed or cached
+	if (params.lazyBvhBuild && (params.bvhBuildMethod == BvhBuildMethod::Morton || params.bvhBuildMethod == BvhBuildMethod::SpatialSplit ||
+		params.treeletPasses > 0 || params.bvhWidth != 2 || params.quantizeBvh || params.bvhCacheFileName.size()))
+	{
+		throw std::invalid_argument("Lazy bvh builds only support median and sah splits in a float binary tree, without treelets or a cache file.");
 	}
 }
 
@@ -305,6 +479,22 @@ Scene * Application::LoadPovrayScene(const std::string & fileName)
 	scene->GetCamera().SetUpVector(p.camera.up);
 	scene->GetCamera().SetRightVector(p.camera.right);
 
+	// Mesh triangles are not scene objects themselves, only instances of the mesh are
+	for (const parser::Mesh & m : p.meshes)
+	{
+		Mesh * mesh = new Mesh();
+
+		for (const parser::Object & t : m.triangles)
+		{
+			Triangle * triangle = new Triangle(t.v1, t.v2, t.v3);
+			triangle->BakeTransform(GetTransform(t.attributes));
+			triangle->StoreBoundingBox();
+			mesh->AddObject(triangle);
+		}
+
+		scene->AddMesh(mesh);
+	}
+
 	for (const parser::Object & o : p.objects)
 	{
 		Object * object = nullptr;
@@ -330,35 +520,20 @@ Scene * Application::LoadPovrayScene(const std::string & fileName)
 		case parser::Object::Type::Cone:
 			std::cerr << "Cone objects not supported." << std::endl;
 			break;
+
+		case parser::Object::Type::Instance:
+			object = new Instance(scene->GetMeshes()[o.mesh]);
+			break;
 		}
 
 		if (object)
 		{
-			glm::mat4 transform = glm::mat4(1.f);
+			glm::mat4 transform = GetTransform(o.attributes);
 
-			for (const parser::Transform & t : o.attributes.transforms)
+			// Fold the transform into the geometry where possible, so the object can be intersected in world space
+			if (object->BakeTransform(transform))
 			{
-				switch (t.type)
-				{
-				case parser::Transform::Type::Translate:
-					transform = glm::translate(glm::mat4(1.f), t.quantity) * transform;
-					break;
-
-				case parser::Transform::Type::Scale:
-					transform = glm::scale(glm::mat4(1.f), t.quantity) * transform;
-					break;
-
-				case parser::Transform::Type::Rotate:
-				{
-					glm::mat4 rotation;
-
-					rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.z), glm::vec3(0, 0, 1)) * rotation;
-					rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.y), glm::vec3(0, 1, 0)) * rotation;
-					rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.x), glm::vec3(1, 0, 0)) * rotation;
-
-					transform = rotation * transform;
-				}
-				}
+				transform = glm::mat4(1.f);
 			}
 
 			object->SetModelMatrix(transform);
@@ -380,3 +555,35 @@ Scene * Application::LoadPovrayScene(const std::string & fileName)
 
 	return scene;
 }
+
+glm::mat4 Application::GetTransform(const parser::Attributes & attributes)
+{
+	glm::mat4 transform = glm::mat4(1.f);
+
+	for (const parser::Transform & t : attributes.transforms)
+	{
+		switch (t.type)
+		{
+		case parser::Transform::Type::Translate:
+			transform = glm::translate(glm::mat4(1.f), t.quantity) * transform;
+			break;
+
+		case parser::Transform::Type::Scale:
+			transform = glm::scale(glm::mat4(1.f), t.quantity) * transform;
+			break;
+
+		case parser::Transform::Type::Rotate:
+		{
+			glm::mat4 rotation;
+
+			rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.z), glm::vec3(0, 0, 1)) * rotation;
+			rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.y), glm::vec3(0, 1, 0)) * rotation;
+			rotation = glm::rotate(glm::mat4(1.f), glm::radians(t.quantity.x), glm::vec3(1, 0, 0)) * rotation;
+
+			transform = rotation * transform;
+		}
+		}
+	}
+
+	return transform;
+}
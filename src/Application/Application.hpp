@@ -30,6 +30,7 @@ protected:
 	void ParseExtraParams(size_t const StartIndex);
 
 	static Scene * LoadPovrayScene(const std::string & fileName);
+	static glm::mat4 GetTransform(const parser::Attributes & attributes);
 
 	std::vector<std::string> commandArguments;
 
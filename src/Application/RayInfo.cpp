@@ -8,6 +8,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <chrono>
 
 #include <RayTracer/PixelContext.hpp>
 
@@ -95,6 +96,8 @@ void RayInfo::PrintTree(Scene * scene)
 {
 	if (scene->GetSpatialDataStructure())
 	{
+		std::cout << "bvh: " << scene->GetSpatialDataStructureDescription() << std::endl;
+		std::cout << std::endl;
 		scene->GetSpatialDataStructure()->PrintTree("root");
 	}
 	else
@@ -103,6 +106,68 @@ void RayInfo::PrintTree(Scene * scene)
 	}
 }
 
+void RayInfo::PrintTreeStatistics(Scene * scene)
+{
+	const SpatialDataStructure * spatialDataStructure = scene->GetSpatialDataStructure();
+
+	if (! spatialDataStructure)
+	{
+		std::cerr << "Cannot print bvh without -sds argument." << std::endl;
+		return;
+	}
+
+	// Camera rays spread evenly over the image, whatever its size, so a fixed grid samples the whole view
+	const glm::ivec2 gridSize = glm::ivec2(StatisticsRayGridSize);
+	long long visitedCount = 0;
+
+	const auto traceStart = std::chrono::steady_clock::now();
+
+	for (int y = 0; y < gridSize.y; ++ y)
+	{
+		for (int x = 0; x < gridSize.x; ++ x)
+		{
+			visitedCount += spatialDataStructure->CountVisitedNodes(scene->GetCamera().GetPixelRay(glm::ivec2(x, y), gridSize));
+		}
+	}
+
+	const double traceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStart).count();
+
+	// Gathered after tracing, so that a lazily built tree shows the nodes the rays have split
+	const SpatialDataStructure::Statistics statistics = spatialDataStructure->GetStatistics();
+	const size_t nodeCount = statistics.interiorCount + statistics.leafCount;
+
+	std::cout << "bvh: " << scene->GetSpatialDataStructureDescription() << std::endl;
+	std::cout << std::endl;
+	std::cout << "build time: " << scene->GetSpatialDataStructureBuildSeconds() * 1000 << " ms" << std::endl;
+	std::cout << "nodes: " << nodeCount << " (" << statistics.interiorCount << " interior, " << statistics.leafCount << " leaves)" << std::endl;
+	std::cout << "primitive references: " << statistics.primitiveReferenceCount << std::endl;
+	std::cout << "sah cost: " << statistics.sahCost << std::endl;
+	std::cout << "sibling overlap ratio: " << (statistics.childArea > 0 ? statistics.siblingOverlapArea / statistics.childArea : 0) << std::endl;
+	std::cout << "memory: " << statistics.nodeBytes + statistics.primitiveBytes << " bytes (" << statistics.nodeBytes << " in nodes, " << statistics.primitiveBytes << " in primitives)" << std::endl;
+	std::cout << "average nodes visited per camera ray: " << (double) visitedCount / (gridSize.x * gridSize.y) << " (" << gridSize.x * gridSize.y << " rays)" << std::endl;
+	std::cout << "camera rays per second: " << (long long) (traceSeconds > 0 ? gridSize.x * gridSize.y / traceSeconds : 0) << " (single thread, closest hit only)" << std::endl;
+
+	std::cout << std::endl;
+	std::cout << "leaves by depth:" << std::endl;
+	for (size_t depth = 0; depth < statistics.leafDepths.size(); ++ depth)
+	{
+		if (statistics.leafDepths[depth])
+		{
+			std::cout << "- " << depth << ": " << statistics.leafDepths[depth] << std::endl;
+		}
+	}
+
+	std::cout << std::endl;
+	std::cout << "leaves by primitive count:" << std::endl;
+	for (size_t size = 0; size < statistics.leafSizes.size(); ++ size)
+	{
+		if (statistics.leafSizes[size])
+		{
+			std::cout << "- " << size << ": " << statistics.leafSizes[size] << std::endl;
+		}
+	}
+}
+
 void RayInfo::RecursiveIterationPrint(const std::string & parentPrefix, const IterationTreeNode * const node, const bool decoration, const bool verbose)
 {
 	PixelContext::Iteration * iteration = node->iteration;
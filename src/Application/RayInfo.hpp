@@ -19,8 +19,13 @@ public:
 	static void DiagnosticTrace(RayTracer * rayTracer, Scene * scene, const int x, const int y, const bool decoration);
 	static void PrintTree(Scene * scene);
 
+	// Summarizes the bvh instead of printing every node, tracing a grid of camera rays through it
+	static void PrintTreeStatistics(Scene * scene);
+
 protected:
 
+	static const int StatisticsRayGridSize = 100;
+
 	struct IterationTreeNode
 	{
 		PixelContext::Iteration * iteration = nullptr;
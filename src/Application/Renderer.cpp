@@ -5,8 +5,8 @@
 
 #include "Renderer.hpp"
 
-#include <atomic>
 #include <thread>
+#include <vector>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
@@ -17,11 +17,22 @@ void Renderer::Draw(RayTracer * rayTracer)
 	glm::ivec2 const imageSize = rayTracer->GetParams().imageSize;
 	unsigned char * imageBuffer = new unsigned char[imageSize.x * imageSize.y * 4]();
 
-	for (int x = 0; x < imageSize.x; ++ x)
+	std::vector<glm::ivec2> pixels;
+
+	// Trace a row at a time so that neighboring primary rays can share packet traversals
+	for (int y = 0; y < imageSize.y; ++ y)
 	{
-		for (int y = 0; y < imageSize.y; ++ y)
+		pixels.clear();
+		for (int x = 0; x < imageSize.x; ++ x)
+		{
+			pixels.push_back(glm::ivec2(x, y));
+		}
+
+		const std::vector<Pixel> colors = rayTracer->CastRaysForPixels(pixels);
+
+		for (int x = 0; x < imageSize.x; ++ x)
 		{
-			Pixel p = rayTracer->CastRaysForPixel(glm::ivec2(x, y));
+			const Pixel & p = colors[x];
 			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 0] = p.red;
 			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 1] = p.green;
 			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 2] = p.blue;
@@ -36,45 +47,60 @@ void Renderer::Draw(RayTracer * rayTracer)
 void Renderer::DrawThreaded(RayTracer * rayTracer, const int numThreads)
 {
 	glm::ivec2 const imageSize = rayTracer->GetParams().imageSize;
-	unsigned char * imageBuffer = new unsigned char[imageSize.x * imageSize.y * 4]();
 
-	int const pixelCount = imageSize.x * imageSize.y;
+	// Pad each row to a whole number of cache lines and align the buffer itself,
+	// so no two tiles ever write to the same cache line
+	int const rowStride = (imageSize.x * 4 + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+	unsigned char * bufferStorage = new unsigned char[rowStride * imageSize.y + CacheLineSize]();
+	unsigned char * imageBuffer = bufferStorage + (CacheLineSize - reinterpret_cast<size_t>(bufferStorage) % CacheLineSize) % CacheLineSize;
 
-	std::atomic<int> doneCount;
-	std::atomic<int> currentPixel;
+	std::vector<Tile> tiles;
+	for (int y = 0; y < imageSize.y; y += TileSize)
+	{
+		for (int x = 0; x < imageSize.x; x += TileSize)
+		{
+			Tile tile;
+			tile.min = glm::ivec2(x, y);
+			tile.max = glm::min(glm::ivec2(x + TileSize, y + TileSize), imageSize);
+			tiles.push_back(tile);
+		}
+	}
 
-	doneCount = 0;
-	currentPixel = 0;
+	// Hand each thread a contiguous run of tiles so neighboring tiles (and the rays they cast) stay together
+	std::vector<TileQueue> queues(numThreads);
+	for (int i = 0; i < numThreads; ++ i)
+	{
+		size_t const begin = tiles.size() * i / numThreads;
+		size_t const end = tiles.size() * (i + 1) / numThreads;
+
+		queues[i].tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+	}
 
 	auto RenderKernel = [&](int const threadIndex)
 	{
+		Tile tile;
+
 		while (true)
 		{
-			int pixel = currentPixel ++;
-
-			if (pixel >= pixelCount)
+			if (queues[threadIndex].Pop(tile))
 			{
-				break;
+				DrawTile(rayTracer, tile, imageBuffer, rowStride);
+				continue;
 			}
 
-			int const x = pixel / imageSize.y;
-			int const y = pixel % imageSize.y;
-
-			Pixel p = rayTracer->CastRaysForPixel(glm::ivec2(x, y));
-			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 0] = p.red;
-			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 1] = p.green;
-			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 2] = p.blue;
-			imageBuffer[x * 4 + (imageSize.y - 1 - y) * 4 * imageSize.x + 3] = 255;
-		}
-
-		doneCount ++;
+			// No tiles are ever added after startup, so if every other queue is empty we are done
+			bool stole = false;
+			for (int i = 1; i < numThreads && ! stole; ++ i)
+			{
+				stole = queues[(threadIndex + i) % numThreads].Steal(tile);
+			}
 
-		if (threadIndex == 0)
-		{
-			while (doneCount < numThreads)
+			if (! stole)
 			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				break;
 			}
+
+			DrawTile(rayTracer, tile, imageBuffer, rowStride);
 		}
 	};
 
@@ -88,6 +114,63 @@ void Renderer::DrawThreaded(RayTracer * rayTracer, const int numThreads)
 		threads[i].join();
 	}
 
-	stbi_write_png("output.png", imageSize.x, imageSize.y, 4, imageBuffer, imageSize.x * 4);
-	delete[] imageBuffer;
+	stbi_write_png("output.png", imageSize.x, imageSize.y, 4, imageBuffer, rowStride);
+	delete[] bufferStorage;
+}
+
+void Renderer::DrawTile(RayTracer * rayTracer, const Tile & tile, unsigned char * imageBuffer, const int rowStride)
+{
+	glm::ivec2 const imageSize = rayTracer->GetParams().imageSize;
+
+	std::vector<glm::ivec2> pixels;
+
+	for (int y = tile.min.y; y < tile.max.y; ++ y)
+	{
+		unsigned char * row = imageBuffer + (imageSize.y - 1 - y) * rowStride;
+
+		pixels.clear();
+		for (int x = tile.min.x; x < tile.max.x; ++ x)
+		{
+			pixels.push_back(glm::ivec2(x, y));
+		}
+
+		const std::vector<Pixel> colors = rayTracer->CastRaysForPixels(pixels);
+
+		for (int x = tile.min.x; x < tile.max.x; ++ x)
+		{
+			const Pixel & p = colors[x - tile.min.x];
+			row[x * 4 + 0] = p.red;
+			row[x * 4 + 1] = p.green;
+			row[x * 4 + 2] = p.blue;
+			row[x * 4 + 3] = 255;
+		}
+	}
+}
+
+bool Renderer::TileQueue::Pop(Tile & outTile)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (tiles.empty())
+	{
+		return false;
+	}
+
+	outTile = tiles.front();
+	tiles.pop_front();
+	return true;
+}
+
+bool Renderer::TileQueue::Steal(Tile & outTile)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (tiles.empty())
+	{
+		return false;
+	}
+
+	outTile = tiles.back();
+	tiles.pop_back();
+	return true;
 }
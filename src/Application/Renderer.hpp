@@ -1,4 +1,3 @@
-
 // Copyright (C) 2018 Ian Dunn
 // For conditions of distribution and use, see the LICENSE file
 
@@ -7,6 +6,9 @@
 
 #include <RayTracer/RayTracer.hpp>
 
+#include <deque>
+#include <mutex>
+
 
 class Renderer
 {
@@ -16,4 +18,29 @@ public:
 	static void Draw(RayTracer * rayTracer);
 	static void DrawThreaded(RayTracer * rayTracer, const int numThreads);
 
+protected:
+
+	// Tiles are 16 pixels wide so that each tile row covers exactly one 64-byte cache line of the image buffer
+	static const int TileSize = 16;
+	static const int CacheLineSize = 64;
+
+	struct Tile
+	{
+		glm::ivec2 min;
+		glm::ivec2 max;
+	};
+
+	// Each thread owns one queue and takes tiles from the front;
+	// threads that run out of work steal from the back of another thread's queue.
+	struct TileQueue
+	{
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+
+		bool Pop(Tile & outTile);
+		bool Steal(Tile & outTile);
+	};
+
+	static void DrawTile(RayTracer * rayTracer, const Tile & tile, unsigned char * imageBuffer, const int rowStride);
+
 };
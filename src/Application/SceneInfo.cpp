@@ -50,6 +50,22 @@ void SceneInfo::PrintInfo(const parser::Parser & p)
 	std::cout << "---" << std::endl;
 	std::cout << std::endl;
 
+	if (p.meshes.size())
+	{
+		std::cout << p.meshes.size() << " mesh(es)" << std::endl;
+		for (size_t i = 0; i < p.meshes.size(); ++ i)
+		{
+			std::cout << std::endl;
+			std::cout << "Mesh[" << i << "]:" << std::endl;
+			std::cout << "- Name: " << p.meshes[i].name << std::endl;
+			std::cout << "- Triangles: " << p.meshes[i].triangles.size() << std::endl;
+		}
+
+		std::cout << std::endl;
+		std::cout << "---" << std::endl;
+		std::cout << std::endl;
+	}
+
 	std::cout << p.objects.size() << " object(s)" << std::endl;
 	for (size_t i = 0; i < p.objects.size(); ++ i)
 	{
@@ -92,6 +108,11 @@ void SceneInfo::PrintInfo(const parser::Parser & p)
 			std::cout << "- Center 2: {" << o.v2 << "}" << std::endl;
 			std::cout << "- Radius 2: " << o.s2 << std::endl;
 			break;
+
+		case parser::Object::Type::Instance:
+			std::cout << "- Type: Instance" << std::endl;
+			std::cout << "- Mesh: " << p.meshes[o.mesh].name << std::endl;
+			break;
 		}
 
 		// if (o.attributes.pigment.w)
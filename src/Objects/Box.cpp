@@ -5,37 +5,28 @@
 
 #include "Box.hpp"
 
-#include <glm/gtc/epsilon.hpp>
-
 
 Box::Box(const glm::vec3 & a, const glm::vec3 & b)
-	: aabb(a, b)
+	: Object(ObjectType::Box), aabb(a, b)
 {}
 
-float Box::Intersect(const Ray & ray) const
+bool Box::Intersect(const Ray & ray, HitRecord & outHit) const
 {
-	return aabb.Intersect(ray);
+	const float t = aabb.Intersect(ray, outHit.face);
+
+	if (t < 0)
+	{
+		return false;
+	}
+
+	outHit.t = t;
+	return true;
 }
 
-glm::vec3 Box::CalculateNormal(glm::vec3 const & intersectionPoint) const
+glm::vec3 Box::CalculateNormal(HitRecord const & hit, glm::vec3 const & /* intersectionPoint */) const
 {
-	static const float epsilon = 0.001f;
-
-	glm::vec3 normal;
-
-	if (glm::epsilonEqual(intersectionPoint.x, aabb.min.x, epsilon))
-		normal = glm::vec3(-1, 0, 0);
-	else if (glm::epsilonEqual(intersectionPoint.x, aabb.max.x, epsilon))
-		normal = glm::vec3(1, 0, 0);
-	else if (glm::epsilonEqual(intersectionPoint.y, aabb.min.y, epsilon))
-		normal = glm::vec3(0, -1, 0);
-	else if (glm::epsilonEqual(intersectionPoint.y, aabb.max.y, epsilon))
-		normal = glm::vec3(0, 1, 0);
-	else if (glm::epsilonEqual(intersectionPoint.z, aabb.min.z, epsilon))
-		normal = glm::vec3(0, 0, -1);
-	else if (glm::epsilonEqual(intersectionPoint.z, aabb.max.z, epsilon))
-		normal = glm::vec3(0, 0, 1);
-
+	glm::vec3 normal = glm::vec3(0.f);
+	normal[hit.face / 2] = hit.face % 2 ? 1.f : -1.f;
 	return normal;
 }
 
@@ -44,7 +35,33 @@ AABB Box::ComputeBoundingBox() const
 	return aabb;
 }
 
+bool Box::BakeTransform(glm::mat4 const & transform)
+{
+	// Only translations and scales keep a box axis-aligned
+	for (int column = 0; column < 3; ++ column)
+	{
+		for (int row = 0; row < 3; ++ row)
+		{
+			if (row != column && transform[column][row] != 0.f)
+			{
+				return false;
+			}
+		}
+	}
+
+	const glm::vec3 a = glm::vec3(transform * glm::vec4(aabb.min, 1.f));
+	const glm::vec3 b = glm::vec3(transform * glm::vec4(aabb.max, 1.f));
+
+	aabb = AABB(glm::min(a, b), glm::max(a, b));
+	return true;
+}
+
 std::string Box::GetObjectType() const
 {
 	return "Box";
 }
+
+const AABB & Box::GetBox() const
+{
+	return aabb;
+}
@@ -15,11 +15,14 @@ class Box : public Object
 public:
 
 	Box(const glm::vec3 & min, const glm::vec3 & max);
-	float Intersect(const Ray & ray) const;
-	glm::vec3 CalculateNormal(glm::vec3 const & intersectionPoint) const;
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
 	AABB ComputeBoundingBox() const;
+	bool BakeTransform(glm::mat4 const & transform);
 	std::string GetObjectType() const;
 
+	const AABB & GetBox() const;
+
 protected:
 
 	AABB aabb;
@@ -0,0 +1,105 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "BoxBatch.hpp"
+
+#include <RayTracer/Simd.hpp>
+
+#include <limits>
+
+
+size_t BoxBatch::Add(const glm::vec3 & min, const glm::vec3 & max)
+{
+	// Every array keeps a full SIMD width of padding past the end, so the last
+	// group of boxes can always be loaded in one piece
+	std::vector<float> * const arrays[] = { & minX, & minY, & minZ, & maxX, & maxY, & maxZ };
+	const float values[] = { min.x, min.y, min.z, max.x, max.y, max.z };
+
+	for (int i = 0; i < 6; ++ i)
+	{
+		arrays[i]->resize(size + 1 + SimdWidth, 0.f);
+		(* arrays[i])[size] = values[i];
+	}
+
+	return size ++;
+}
+
+size_t BoxBatch::GetSize() const
+{
+	return size;
+}
+
+size_t BoxBatch::GetMemoryUsage() const
+{
+	// Every array holds the same number of floats
+	return 6 * minX.capacity() * sizeof(float);
+}
+
+int BoxBatch::IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const
+{
+	// Same formulation as AABB::Intersect, one box per lane
+	const std::vector<float> * const mins[3] = { & minX, & minY, & minZ };
+	const std::vector<float> * const maxs[3] = { & maxX, & maxY, & maxZ };
+
+	SimdFloat largestMin = std::numeric_limits<float>::lowest();
+	SimdFloat smallestMax = std::numeric_limits<float>::max();
+	int insideSlabs = (1 << SimdWidth) - 1;
+
+	// Faces are numbered as in AABB::Intersect and stored as floats so they can be selected per lane
+	SimdFloat entryFace = -1.f;
+	SimdFloat exitFace = -1.f;
+
+	for (int i = 0; i < 3; ++ i)
+	{
+		const SimdFloat boxMin = SimdFloat::Load(& (* mins[i])[index]);
+		const SimdFloat boxMax = SimdFloat::Load(& (* maxs[i])[index]);
+
+		if (ray.direction[i] == 0)
+		{
+			insideSlabs &= ((boxMin <= SimdFloat(ray.origin[i])) & (boxMax >= SimdFloat(ray.origin[i]))).Bits();
+		}
+		else
+		{
+			const SimdFloat t1 = (boxMin - SimdFloat(ray.origin[i])) / SimdFloat(ray.direction[i]);
+			const SimdFloat t2 = (boxMax - SimdFloat(ray.origin[i])) / SimdFloat(ray.direction[i]);
+
+			const SimdFloat near = SimdFloat::Min(t1, t2);
+			const SimdFloat far = SimdFloat::Max(t1, t2);
+
+			// Rays along the positive axis enter through the face at the minimum
+			const bool positive = ray.direction[i] > 0;
+			entryFace = SimdFloat::Select(near > largestMin, SimdFloat((float) (i * 2 + (positive ? 0 : 1))), entryFace);
+			exitFace = SimdFloat::Select(far < smallestMax, SimdFloat((float) (i * 2 + (positive ? 1 : 0))), exitFace);
+
+			largestMin = SimdFloat::Max(near, largestMin);
+			smallestMax = SimdFloat::Min(far, smallestMax);
+		}
+	}
+
+	// Rays starting inside a box hit it where they leave
+	const SimdMask entering = largestMin > SimdFloat(0.f);
+	const SimdFloat t = SimdFloat::Select(entering, largestMin, smallestMax);
+	const SimdFloat face = SimdFloat::Select(entering, entryFace, exitFace);
+
+	const SimdMask hit = (largestMin <= smallestMax) & (smallestMax >= SimdFloat(0.f)) & (t < SimdFloat(tMax));
+
+	// Lanes past the end of the range hold neighboring (or padding) boxes
+	const int laneCount = count < (size_t) SimdWidth ? (int) count : SimdWidth;
+	const int hits = hit.Bits() & insideSlabs & ((1 << laneCount) - 1);
+
+	if (outHits)
+	{
+		float intersects[SimdWidth], faces[SimdWidth];
+		t.Store(intersects);
+		face.Store(faces);
+
+		for (int lane = 0; lane < laneCount; ++ lane)
+		{
+			outHits[lane].t = intersects[lane];
+			outHits[lane].face = (int) faces[lane];
+		}
+	}
+
+	return hits;
+}
@@ -0,0 +1,55 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "Instance.hpp"
+
+
+Instance::Instance(const Mesh * mesh)
+	: Object(ObjectType::Instance)
+{
+	this->mesh = mesh;
+}
+
+bool Instance::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord hit;
+
+	if (! mesh->GetSpatialDataStructure()->Intersect(ray, hit))
+	{
+		return false;
+	}
+
+	// The hit is reported as this instance, so that it is shaded with the instance's material
+	outHit.t = hit.t;
+	outHit.face = hit.face;
+	outHit.barycentrics = hit.barycentrics;
+	outHit.primitive = hit.object;
+	return true;
+}
+
+glm::vec3 Instance::CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const
+{
+	return hit.primitive->CalculateNormalTransformed(hit, intersectionPoint);
+}
+
+AABB Instance::ComputeBoundingBox() const
+{
+	return mesh->GetBoundingBox();
+}
+
+bool Instance::BakeTransform(glm::mat4 const & transform)
+{
+	// Baking anything but the identity would mean copying the mesh, which is what instancing avoids
+	return transform == glm::mat4(1.f);
+}
+
+std::string Instance::GetObjectType() const
+{
+	return "Instance";
+}
+
+const Mesh * Instance::GetMesh() const
+{
+	return mesh;
+}
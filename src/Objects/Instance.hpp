@@ -0,0 +1,31 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <Scene/Object.hpp>
+#include <Scene/Mesh.hpp>
+
+
+// One placement of a shared mesh. The model matrix carries the ray into the mesh's
+// object space, where the mesh's own spatial data structure finds the closest hit.
+class Instance : public Object
+{
+
+public:
+
+	Instance(const Mesh * mesh);
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
+	AABB ComputeBoundingBox() const;
+	bool BakeTransform(glm::mat4 const & transform);
+	std::string GetObjectType() const;
+
+	const Mesh * GetMesh() const;
+
+protected:
+
+	const Mesh * mesh;
+
+};
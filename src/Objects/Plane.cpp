@@ -7,10 +7,10 @@
 
 
 Plane::Plane(const glm::vec3 & n, const float d)
- : normal(n), distance(d)
+ : Object(ObjectType::Plane), normal(n), distance(d)
 {}
 
-float Plane::Intersect(const Ray & ray) const
+bool Plane::Intersect(const Ray & ray, HitRecord & outHit) const
 {
 	float const denominator = glm::dot(ray.direction, normal);
 
@@ -21,14 +21,15 @@ float Plane::Intersect(const Ray & ray) const
 
 		if (t >= 0)
 		{
-			return t;
+			outHit.t = t;
+			return true;
 		}
 	}
 
-	return -1;
+	return false;
 }
 
-glm::vec3 Plane::CalculateNormal(glm::vec3 const & intersectionPoint) const
+glm::vec3 Plane::CalculateNormal(HitRecord const & /* hit */, glm::vec3 const & /* intersectionPoint */) const
 {
 	return normal;
 }
@@ -38,7 +39,27 @@ AABB Plane::ComputeBoundingBox() const
 	return AABB(glm::vec3(std::numeric_limits<float>::lowest()), glm::vec3(std::numeric_limits<float>::max()));
 }
 
+bool Plane::BakeTransform(glm::mat4 const & transform)
+{
+	// Move one point of the plane and transform the normal like a normal
+	const glm::vec3 point = glm::vec3(transform * glm::vec4(normal * distance / glm::dot(normal, normal), 1.f));
+
+	normal = glm::normalize(glm::vec3(glm::transpose(glm::inverse(transform)) * glm::vec4(normal, 0.f)));
+	distance = glm::dot(normal, point);
+	return true;
+}
+
 std::string Plane::GetObjectType() const
 {
 	return "Plane";
 }
+
+const glm::vec3 & Plane::GetNormal() const
+{
+	return normal;
+}
+
+float Plane::GetDistance() const
+{
+	return distance;
+}
@@ -14,11 +14,15 @@ class Plane : public Object
 public:
 
 	Plane(const glm::vec3 & n, const float d);
-	float Intersect(const Ray & ray) const;
-	glm::vec3 CalculateNormal(glm::vec3 const & intersectionPoint) const;
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
 	AABB ComputeBoundingBox() const;
+	bool BakeTransform(glm::mat4 const & transform);
 	std::string GetObjectType() const;
 
+	const glm::vec3 & GetNormal() const;
+	float GetDistance() const;
+
 protected:
 
 	glm::vec3 normal;
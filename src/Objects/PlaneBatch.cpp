@@ -0,0 +1,66 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "PlaneBatch.hpp"
+
+#include <RayTracer/Simd.hpp>
+
+
+size_t PlaneBatch::Add(const glm::vec3 & normal, const float distance)
+{
+	// Every array keeps a full SIMD width of padding past the end, so the last
+	// group of planes can always be loaded in one piece
+	std::vector<float> * const arrays[] = { & normalX, & normalY, & normalZ, & this->distance };
+	const float values[] = { normal.x, normal.y, normal.z, distance };
+
+	for (int i = 0; i < 4; ++ i)
+	{
+		arrays[i]->resize(size + 1 + SimdWidth, 0.f);
+		(* arrays[i])[size] = values[i];
+	}
+
+	return size ++;
+}
+
+size_t PlaneBatch::GetSize() const
+{
+	return size;
+}
+
+size_t PlaneBatch::GetMemoryUsage() const
+{
+	// Every array holds the same number of floats
+	return 4 * normalX.capacity() * sizeof(float);
+}
+
+int PlaneBatch::IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const
+{
+	// Same formulation as Plane::Intersect, one plane per lane
+	const SimdFloat x = SimdFloat::Load(& normalX[index]);
+	const SimdFloat y = SimdFloat::Load(& normalY[index]);
+	const SimdFloat z = SimdFloat::Load(& normalZ[index]);
+
+	const SimdFloat denominator = SimdFloat(ray.direction.x) * x + SimdFloat(ray.direction.y) * y + SimdFloat(ray.direction.z) * z;
+	const SimdFloat numerator = SimdFloat::Load(& distance[index]) - (SimdFloat(ray.origin.x) * x + SimdFloat(ray.origin.y) * y + SimdFloat(ray.origin.z) * z);
+	const SimdFloat t = numerator / denominator;
+
+	const SimdMask hit = (denominator != SimdFloat(0.f)) & (t >= SimdFloat(0.f)) & (t < SimdFloat(tMax));
+
+	// Lanes past the end of the range hold neighboring (or padding) planes
+	const int laneCount = count < (size_t) SimdWidth ? (int) count : SimdWidth;
+	const int hits = hit.Bits() & ((1 << laneCount) - 1);
+
+	if (outHits)
+	{
+		float intersects[SimdWidth];
+		t.Store(intersects);
+
+		for (int lane = 0; lane < laneCount; ++ lane)
+		{
+			outHits[lane].t = intersects[lane];
+		}
+	}
+
+	return hits;
+}
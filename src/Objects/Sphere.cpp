@@ -7,10 +7,10 @@
 
 
 Sphere::Sphere(const glm::vec3 & c, const float r)
- : center(c), radius(r)
+ : Object(ObjectType::Sphere), center(c), radius(r)
 {}
 
-float Sphere::Intersect(const Ray & ray) const
+bool Sphere::Intersect(const Ray & ray, HitRecord & outHit) const
 {
 	const glm::vec3 offset = ray.origin - center;
 
@@ -35,14 +35,15 @@ float Sphere::Intersect(const Ray & ray) const
 
 		if (t >= 0.f)
 		{
-			return t;
+			outHit.t = t;
+			return true;
 		}
 	}
 
-	return -1;
+	return false;
 }
 
-glm::vec3 Sphere::CalculateNormal(glm::vec3 const & intersectionPoint) const
+glm::vec3 Sphere::CalculateNormal(HitRecord const & /* hit */, glm::vec3 const & intersectionPoint) const
 {
 	return glm::normalize(intersectionPoint - center);
 }
@@ -52,7 +53,41 @@ AABB Sphere::ComputeBoundingBox() const
 	return AABB(center - glm::vec3(radius), center + glm::vec3(radius));
 }
 
+bool Sphere::BakeTransform(glm::mat4 const & transform)
+{
+	static const float epsilon = 1e-5f;
+
+	// Only rotations, translations and uniform scales keep a sphere round
+	const glm::vec3 x = glm::vec3(transform[0]);
+	const glm::vec3 y = glm::vec3(transform[1]);
+	const glm::vec3 z = glm::vec3(transform[2]);
+	const float scale = glm::length(x);
+
+	if (glm::abs(glm::length(y) - scale) > epsilon * scale ||
+		glm::abs(glm::length(z) - scale) > epsilon * scale ||
+		glm::abs(glm::dot(x, y)) > epsilon * scale * scale ||
+		glm::abs(glm::dot(y, z)) > epsilon * scale * scale ||
+		glm::abs(glm::dot(z, x)) > epsilon * scale * scale)
+	{
+		return false;
+	}
+
+	center = glm::vec3(transform * glm::vec4(center, 1.f));
+	radius *= scale;
+	return true;
+}
+
 std::string Sphere::GetObjectType() const
 {
 	return "Sphere";
 }
+
+const glm::vec3 & Sphere::GetCenter() const
+{
+	return center;
+}
+
+float Sphere::GetRadius() const
+{
+	return radius;
+}
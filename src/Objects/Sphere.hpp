@@ -14,11 +14,15 @@ class Sphere : public Object
 public:
 
 	Sphere(const glm::vec3 & c, const float r);
-	float Intersect(const Ray & ray) const;
-	glm::vec3 CalculateNormal(glm::vec3 const & intersectionPoint) const;
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
 	AABB ComputeBoundingBox() const;
+	bool BakeTransform(glm::mat4 const & transform);
 	std::string GetObjectType() const;
 
+	const glm::vec3 & GetCenter() const;
+	float GetRadius() const;
+
 protected:
 
 	float radius;
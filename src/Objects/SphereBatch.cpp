@@ -0,0 +1,77 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "SphereBatch.hpp"
+
+#include <RayTracer/Simd.hpp>
+
+
+size_t SphereBatch::Add(const glm::vec3 & center, const float radius)
+{
+	// Every array keeps a full SIMD width of padding past the end, so the last
+	// group of spheres can always be loaded in one piece
+	std::vector<float> * const arrays[] = { & centerX, & centerY, & centerZ, & radiusSquared };
+	const float values[] = { center.x, center.y, center.z, radius * radius };
+
+	for (int i = 0; i < 4; ++ i)
+	{
+		arrays[i]->resize(size + 1 + SimdWidth, 0.f);
+		(* arrays[i])[size] = values[i];
+	}
+
+	return size ++;
+}
+
+size_t SphereBatch::GetSize() const
+{
+	return size;
+}
+
+size_t SphereBatch::GetMemoryUsage() const
+{
+	// Every array holds the same number of floats
+	return 4 * centerX.capacity() * sizeof(float);
+}
+
+int SphereBatch::IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const
+{
+	// Same formulation as Sphere::Intersect, one sphere per lane
+	const SimdFloat directionX = ray.direction.x;
+	const SimdFloat directionY = ray.direction.y;
+	const SimdFloat directionZ = ray.direction.z;
+
+	const SimdFloat offsetX = SimdFloat(ray.origin.x) - SimdFloat::Load(& centerX[index]);
+	const SimdFloat offsetY = SimdFloat(ray.origin.y) - SimdFloat::Load(& centerY[index]);
+	const SimdFloat offsetZ = SimdFloat(ray.origin.z) - SimdFloat::Load(& centerZ[index]);
+
+	const float a = glm::dot(ray.direction, ray.direction);
+	const SimdFloat b = SimdFloat(2.f) * (directionX * offsetX + directionY * offsetY + directionZ * offsetZ);
+	const SimdFloat c = (offsetX * offsetX + offsetY * offsetY + offsetZ * offsetZ) - SimdFloat::Load(& radiusSquared[index]);
+
+	const SimdFloat discriminant = b * b - SimdFloat(4.f * a) * c;
+	const SimdFloat sqrtDiscriminant = SimdFloat::Sqrt(SimdFloat::Max(discriminant, SimdFloat(0.f)));
+
+	const SimdFloat nearNumerator = SimdFloat(0.f) - b - sqrtDiscriminant;
+	const SimdFloat numerator = SimdFloat::Select(nearNumerator < SimdFloat(0.f), SimdFloat(0.f) - b + sqrtDiscriminant, nearNumerator);
+	const SimdFloat t = numerator / SimdFloat(2.f * a);
+
+	const SimdMask hit = (discriminant >= SimdFloat(0.f)) & (t >= SimdFloat(0.f)) & (t < SimdFloat(tMax));
+
+	// Lanes past the end of the range hold neighboring (or padding) spheres
+	const int laneCount = count < (size_t) SimdWidth ? (int) count : SimdWidth;
+	const int hits = hit.Bits() & ((1 << laneCount) - 1);
+
+	if (outHits)
+	{
+		float intersects[SimdWidth];
+		t.Store(intersects);
+
+		for (int lane = 0; lane < laneCount; ++ lane)
+		{
+			outHits[lane].t = intersects[lane];
+		}
+	}
+
+	return hits;
+}
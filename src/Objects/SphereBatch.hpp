@@ -0,0 +1,37 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <RayTracer/Ray.hpp>
+#include <Scene/Object.hpp>
+
+
+// World-space spheres stored one component per array so that SimdWidth of them can be tested against a ray at once
+class SphereBatch
+{
+
+public:
+
+	size_t Add(const glm::vec3 & center, const float radius);
+	size_t GetSize() const;
+
+	// Bytes allocated for the batch's arrays
+	size_t GetMemoryUsage() const;
+
+	// Tests up to SimdWidth spheres starting at index and returns one bit per sphere hit in [0, tMax).
+	// If outHits is given, the hit record of each hit is filled in, one per lane.
+	int IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const;
+
+protected:
+
+	size_t size = 0;
+
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> radiusSquared;
+
+};
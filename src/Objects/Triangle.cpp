@@ -7,6 +7,7 @@
 
 
 Triangle::Triangle(const glm::vec3 & v1, const glm::vec3 & v2, const glm::vec3 & v3)
+	: Object(ObjectType::Triangle)
 {
 	this->v1 = v1;
 	this->v2 = v2;
@@ -15,7 +16,7 @@ Triangle::Triangle(const glm::vec3 & v1, const glm::vec3 & v2, const glm::vec3 &
 	normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
 }
 
-float Triangle::Intersect(const Ray & ray) const
+bool Triangle::Intersect(const Ray & ray, HitRecord & outHit) const
 {
 	const glm::vec3 abc = v1 - v2;
 	const glm::vec3 def = v1 - v3;
@@ -29,12 +30,12 @@ float Triangle::Intersect(const Ray & ray) const
 	const float denom = abc.x * ei_hf + abc.y * gf_di + abc.z * dh_eg;
 
 	if (denom == 0.f)
-		return -1;
+		return false;
 
 	const float beta = (jkl.x * ei_hf + jkl.y * gf_di + jkl.z * dh_eg) / denom;
 
 	if (beta < 0 || beta > 1)
-		return -1;
+		return false;
 
 	const float ak_jb = abc.x * jkl.y - jkl.x * abc.y;
 	const float jc_al = jkl.x * abc.z - abc.x * jkl.z;
@@ -43,17 +44,19 @@ float Triangle::Intersect(const Ray & ray) const
 	const float gamma = (ghi.z * ak_jb + ghi.y * jc_al + ghi.x * bl_kc) / denom;
 
 	if (gamma < 0 || gamma > 1 - beta)
-		return -1;
+		return false;
 
 	const float t = (-def.z * ak_jb + -def.y * jc_al + -def.x * bl_kc) / denom;
 
 	if (t < 0)
-		return -1;
+		return false;
 
-	return t;
+	outHit.t = t;
+	outHit.barycentrics = glm::vec2(beta, gamma);
+	return true;
 }
 
-glm::vec3 Triangle::CalculateNormal(glm::vec3 const & intersectionPoint) const
+glm::vec3 Triangle::CalculateNormal(HitRecord const & /* hit */, glm::vec3 const & /* intersectionPoint */) const
 {
 	return normal;
 }
@@ -67,7 +70,32 @@ AABB Triangle::ComputeBoundingBox() const
 	return aabb;
 }
 
+bool Triangle::BakeTransform(glm::mat4 const & transform)
+{
+	// Keep the normal pointing the same way as it would through the model matrix, even for mirroring transforms
+	normal = glm::normalize(glm::vec3(glm::transpose(glm::inverse(transform)) * glm::vec4(normal, 0.f)));
+
+	v1 = glm::vec3(transform * glm::vec4(v1, 1.f));
+	v2 = glm::vec3(transform * glm::vec4(v2, 1.f));
+	v3 = glm::vec3(transform * glm::vec4(v3, 1.f));
+	return true;
+}
+
 std::string Triangle::GetObjectType() const
 {
 	return "Triangle";
 }
+
+const glm::vec3 & Triangle::GetVertex(const int index) const
+{
+	switch (index)
+	{
+	default:
+	case 0:
+		return v1;
+	case 1:
+		return v2;
+	case 2:
+		return v3;
+	}
+}
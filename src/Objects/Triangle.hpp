@@ -14,11 +14,14 @@ class Triangle : public Object
 public:
 
 	Triangle(const glm::vec3 & v1, const glm::vec3 & v2, const glm::vec3 & v3);
-	float Intersect(const Ray & ray) const;
-	glm::vec3 CalculateNormal(glm::vec3 const & intersectionPoint) const;
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
 	AABB ComputeBoundingBox() const;
+	bool BakeTransform(glm::mat4 const & transform);
 	std::string GetObjectType() const;
 
+	const glm::vec3 & GetVertex(const int index) const;
+
 protected:
 
 	glm::vec3 v1, v2, v3;
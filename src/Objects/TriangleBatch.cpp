@@ -0,0 +1,101 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "TriangleBatch.hpp"
+
+#include <RayTracer/Simd.hpp>
+
+
+size_t TriangleBatch::Add(const glm::vec3 & v1, const glm::vec3 & v2, const glm::vec3 & v3)
+{
+	const glm::vec3 e1 = v2 - v1;
+	const glm::vec3 e2 = v3 - v1;
+
+	// Every array keeps a full SIMD width of padding past the end, so the last
+	// group of triangles can always be loaded in one piece
+	std::vector<float> * const arrays[] = { & v1x, & v1y, & v1z, & e1x, & e1y, & e1z, & e2x, & e2y, & e2z };
+	const float values[] = { v1.x, v1.y, v1.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+
+	for (int i = 0; i < 9; ++ i)
+	{
+		arrays[i]->resize(size + 1 + SimdWidth, 0.f);
+		(* arrays[i])[size] = values[i];
+	}
+
+	return size ++;
+}
+
+size_t TriangleBatch::GetSize() const
+{
+	return size;
+}
+
+size_t TriangleBatch::GetMemoryUsage() const
+{
+	// Every array holds the same number of floats
+	return 9 * v1x.capacity() * sizeof(float);
+}
+
+int TriangleBatch::IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const
+{
+	const SimdFloat directionX = ray.direction.x;
+	const SimdFloat directionY = ray.direction.y;
+	const SimdFloat directionZ = ray.direction.z;
+
+	const SimdFloat edge1X = SimdFloat::Load(& e1x[index]);
+	const SimdFloat edge1Y = SimdFloat::Load(& e1y[index]);
+	const SimdFloat edge1Z = SimdFloat::Load(& e1z[index]);
+	const SimdFloat edge2X = SimdFloat::Load(& e2x[index]);
+	const SimdFloat edge2Y = SimdFloat::Load(& e2y[index]);
+	const SimdFloat edge2Z = SimdFloat::Load(& e2z[index]);
+
+	// p = direction x e2
+	const SimdFloat pX = directionY * edge2Z - directionZ * edge2Y;
+	const SimdFloat pY = directionZ * edge2X - directionX * edge2Z;
+	const SimdFloat pZ = directionX * edge2Y - directionY * edge2X;
+
+	const SimdFloat determinant = edge1X * pX + edge1Y * pY + edge1Z * pZ;
+	const SimdFloat inverseDeterminant = SimdFloat(1.f) / determinant;
+
+	// s = origin - v1
+	const SimdFloat sX = SimdFloat(ray.origin.x) - SimdFloat::Load(& v1x[index]);
+	const SimdFloat sY = SimdFloat(ray.origin.y) - SimdFloat::Load(& v1y[index]);
+	const SimdFloat sZ = SimdFloat(ray.origin.z) - SimdFloat::Load(& v1z[index]);
+
+	const SimdFloat beta = (sX * pX + sY * pY + sZ * pZ) * inverseDeterminant;
+
+	// q = s x e1
+	const SimdFloat qX = sY * edge1Z - sZ * edge1Y;
+	const SimdFloat qY = sZ * edge1X - sX * edge1Z;
+	const SimdFloat qZ = sX * edge1Y - sY * edge1X;
+
+	const SimdFloat gamma = (directionX * qX + directionY * qY + directionZ * qZ) * inverseDeterminant;
+	const SimdFloat t = (edge2X * qX + edge2Y * qY + edge2Z * qZ) * inverseDeterminant;
+
+	const SimdMask hit =
+		(determinant != SimdFloat(0.f)) &
+		(beta >= SimdFloat(0.f)) & (beta <= SimdFloat(1.f)) &
+		(gamma >= SimdFloat(0.f)) & (beta + gamma <= SimdFloat(1.f)) &
+		(t >= SimdFloat(0.f)) & (t < SimdFloat(tMax));
+
+	// Lanes past the end of the range hold neighboring (or padding) triangles
+	const int laneCount = count < (size_t) SimdWidth ? (int) count : SimdWidth;
+	const int hits = hit.Bits() & ((1 << laneCount) - 1);
+
+	if (outHits)
+	{
+		float intersects[SimdWidth], betas[SimdWidth], gammas[SimdWidth];
+		t.Store(intersects);
+		beta.Store(betas);
+		gamma.Store(gammas);
+
+		for (int lane = 0; lane < laneCount; ++ lane)
+		{
+			outHits[lane].t = intersects[lane];
+			outHits[lane].barycentrics = glm::vec2(betas[lane], gammas[lane]);
+		}
+	}
+
+	return hits;
+}
@@ -0,0 +1,39 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <RayTracer/Ray.hpp>
+#include <Scene/Object.hpp>
+
+
+// World-space triangles stored one component per array, with the edges precomputed,
+// so that SimdWidth triangles can be tested against a ray with one Moller-Trumbore kernel.
+class TriangleBatch
+{
+
+public:
+
+	size_t Add(const glm::vec3 & v1, const glm::vec3 & v2, const glm::vec3 & v3);
+	size_t GetSize() const;
+
+	// Bytes allocated for the batch's arrays
+	size_t GetMemoryUsage() const;
+
+	// Tests up to SimdWidth triangles starting at index and returns one bit per triangle hit in [0, tMax).
+	// If outHits is given, the hit record of each hit is filled in, one per lane.
+	int IntersectMask(const Ray & ray, const size_t index, const size_t count, const float tMax, HitRecord * outHits) const;
+
+protected:
+
+	size_t size = 0;
+
+	std::vector<float> v1x, v1y, v1z;
+	std::vector<float> e1x, e1y, e1z;
+	std::vector<float> e2x, e2y, e2z;
+
+};
@@ -0,0 +1,119 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string & fileName)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, & fileSize) && fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	}
+
+	// The view keeps the file open, so neither handle is needed past this point
+	CloseHandle(file);
+
+	if (! mapping)
+	{
+		return false;
+	}
+
+	data = (uint8_t *) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (! data)
+	{
+		return false;
+	}
+
+	size = (size_t) fileSize.QuadPart;
+#else
+	const int file = open(fileName.c_str(), O_RDONLY);
+
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat status;
+
+	if (fstat(file, & status) != 0 || status.st_size <= 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void * mapping = mmap(nullptr, (size_t) status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+	// The mapping keeps the file open, so the descriptor is not needed past this point
+	close(file);
+
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	data = (uint8_t *) mapping;
+	size = (size_t) status.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (! data)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+
+	data = nullptr;
+	size = 0;
+}
+
+uint8_t * MappedFile::GetData() const
+{
+	return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return size;
+}
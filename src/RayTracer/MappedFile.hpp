@@ -0,0 +1,37 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+
+// A whole file mapped into memory. The mapping is copy-on-write:
+// it can be modified in place, but changes never reach the file.
+class MappedFile
+{
+
+	// non-copyable
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator =(const MappedFile &) = delete;
+
+public:
+
+	MappedFile() = default;
+	~MappedFile();
+
+	bool Open(const std::string & fileName);
+	void Close();
+
+	uint8_t * GetData() const;
+	size_t GetSize() const;
+
+protected:
+
+	uint8_t * data = nullptr;
+	size_t size = 0;
+
+};
@@ -6,8 +6,33 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <string>
+#include <cstdint>
 
 
+enum class SpatialDataStructureType
+{
+	BoundingVolumeHierarchy,
+
+	// SAH kd-tree, which splits space instead of objects
+	KdTree,
+
+	// Two-level uniform grid, which is quick to build but adapts poorly to uneven scenes
+	Grid
+};
+
+enum class BvhBuildMethod
+{
+	Median,
+	SurfaceAreaHeuristic,
+
+	// Linear bvh: objects sorted along a Morton curve, trading tree quality for build speed
+	Morton,
+
+	// SAH bvh that may also split space, clipping objects that straddle the plane into both children
+	SpatialSplit
+};
+
 struct Params
 {
 	glm::ivec2 imageSize;
@@ -24,7 +49,35 @@ struct Params
 	int recursiveDepth = 6;
 	int superSampling = 1;
 
+	// Until a flag picks the spatial data structure (or none), it is chosen from the scene and image size
+	bool chooseSpatialDataStructure = true;
 	bool useSpatialDataStructure = false;
+	SpatialDataStructureType spatialDataStructureType = SpatialDataStructureType::BoundingVolumeHierarchy;
+
+	BvhBuildMethod bvhBuildMethod = BvhBuildMethod::Median;
+	int bvhLeafSize = 1;
+
+	// Spatial splits may add at most this many object references, as a fraction of the object count
+	float spatialSplitBudget = 0.3f;
+
+	// Optimization passes over the built bvh, each restructuring small treelets to lower its SAH cost
+	int treeletPasses = 0;
+
+	// Children per bvh node: 2, or 4 or 8 for a collapsed bvh tested with SIMD
+	int bvhWidth = 2;
+
+	// Store child bounds as 8-bit steps across the parent's box instead of floats
+	bool quantizeBvh = false;
+
+	// Split bvh nodes only when a ray first reaches them, instead of building the whole tree up front
+	bool lazyBvhBuild = false;
+
+	int threadCount = 1;
+
+	// With a file name, the bvh is loaded from this file if it was built from the same scene file
+	// with the same options, and otherwise built and saved to it
+	std::string bvhCacheFileName;
+	uint64_t sceneFileHash = 0;
 
 	bool debugNormals = false;
 };
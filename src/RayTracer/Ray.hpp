@@ -60,3 +60,24 @@ public:
 	}
 
 };
+
+// Values that every slab test in a traversal would otherwise recompute from the same ray
+struct PrecomputedRay
+{
+
+	glm::vec3 origin;
+	glm::vec3 inverseDirection;
+	int sign[3];
+
+	PrecomputedRay(Ray const & ray)
+	{
+		origin = ray.origin;
+		inverseDirection = 1.f / ray.direction;
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			sign[i] = inverseDirection[i] < 0 ? 1 : 0;
+		}
+	}
+
+};
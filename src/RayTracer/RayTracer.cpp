@@ -33,9 +33,12 @@ void RayTracer::SetParams(const Params & params)
 		brdf = new BlinnPhongBRDF();
 	}
 
+	// Instances always traverse their mesh's hierarchy, even when the scene's own objects are tested one by one
+	scene->BuildMeshSpatialDataStructures(params);
+
 	if (params.useSpatialDataStructure)
 	{
-		scene->BuildSpatialDataStructure();
+		scene->BuildSpatialDataStructure(params);
 	}
 }
 
@@ -70,13 +73,56 @@ Pixel RayTracer::CastRaysForPixel(const glm::ivec2 & pixel) const
 	return Pixel(color);
 }
 
+std::vector<Pixel> RayTracer::CastRaysForPixels(const std::vector<glm::ivec2> & pixels) const
+{
+	const int samplesPerPixel = params.superSampling * params.superSampling;
+
+	// Primary rays for neighboring pixels (and the sub-pixel rays within one pixel) are coherent,
+	// so find all of their hits together with packet traversal before shading each one
+	std::vector<Ray> rays;
+	for (const glm::ivec2 & pixel : pixels)
+	{
+		for (int i = 0; i < params.superSampling; ++ i)
+		{
+			for (int j = 0; j < params.superSampling; ++ j)
+			{
+				rays.push_back(scene->GetCamera().GetPixelRay(pixel, params.imageSize, glm::ivec2(i, j), params.superSampling));
+			}
+		}
+	}
+
+	std::vector<RayHitResults> hitResults(rays.size());
+	scene->GetRayHitResults(rays.data(), (int) rays.size(), hitResults.data());
+
+	std::vector<Pixel> colors;
+	for (size_t p = 0; p < pixels.size(); ++ p)
+	{
+		glm::vec3 color = glm::vec3(0.f);
+
+		for (int s = 0; s < samplesPerPixel; ++ s)
+		{
+			const size_t index = p * samplesPerPixel + s;
+			color += CastRay(rays[index], hitResults[index], params.recursiveDepth).ToColor();
+		}
+
+		color /= glm::pow((float) params.superSampling, 2.f);
+		colors.push_back(Pixel(color));
+	}
+
+	return colors;
+}
+
 RayTraceResults RayTracer::CastRay(const Ray & ray, const int depth) const
+{
+	return CastRay(ray, scene->GetRayHitResults(ray), depth);
+}
+
+RayTraceResults RayTracer::CastRay(const Ray & ray, const RayHitResults & hitResults, const int depth) const
 {
 	const float surfaceEpsilon = 0.001f;
 
 	RayTraceResults results;
 
-	const RayHitResults hitResults = scene->GetRayHitResults(ray);
 	const Object * hitObject = hitResults.object;
 
 	PixelContext::Iteration * contextIteration = nullptr;
@@ -40,7 +40,9 @@ public:
 	const Params & GetParams() const;
 
 	Pixel CastRaysForPixel(const glm::ivec2 & Pixel) const;
+	std::vector<Pixel> CastRaysForPixels(const std::vector<glm::ivec2> & pixels) const;
 	RayTraceResults CastRay(const Ray & ray, const int depth) const;
+	RayTraceResults CastRay(const Ray & ray, const RayHitResults & hitResults, const int depth) const;
 	glm::vec3 GetAmbientResults(const Object * const HhtObject, const glm::vec3 & point, const glm::vec3 & normal, const int depth) const;
 	LightingResults GetLightingResults(const Light * const light, const Material & Material, const glm::vec3 & point, const glm::vec3 & view, const glm::vec3 & normal) const;
 	glm::vec3 GetReflectionResults(const glm::vec3 & point, const glm::vec3 & reflection, const int depth, PixelContext::Iteration * currentIteration = nullptr) const;
@@ -0,0 +1,188 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+// Thin wrappers over the widest SIMD instruction set enabled at compile time:
+// 8 lanes with AVX, 4 lanes with SSE2, or 4 emulated lanes otherwise.
+
+#if defined(__AVX__)
+#define RAYTRACER_SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACER_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+
+#if defined(RAYTRACER_SIMD_AVX)
+
+static const int SimdWidth = 8;
+
+struct SimdMask
+{
+	__m256 v;
+
+	SimdMask() = default;
+	SimdMask(__m256 const v) : v(v) {}
+
+	SimdMask operator & (SimdMask const other) const { return _mm256_and_ps(v, other.v); }
+	SimdMask operator | (SimdMask const other) const { return _mm256_or_ps(v, other.v); }
+	SimdMask AndNot(SimdMask const other) const { return _mm256_andnot_ps(other.v, v); }
+
+	// One bit per lane, lane 0 in the lowest bit
+	int Bits() const { return _mm256_movemask_ps(v); }
+	bool Any() const { return Bits() != 0; }
+};
+
+struct SimdFloat
+{
+	__m256 v;
+
+	SimdFloat() = default;
+	SimdFloat(__m256 const v) : v(v) {}
+	SimdFloat(float const s) : v(_mm256_set1_ps(s)) {}
+
+	static SimdFloat Load(float const * p) { return _mm256_loadu_ps(p); }
+
+	// Widens SimdWidth unsigned bytes. AVX has no 256-bit integer conversions, so each half is widened with SSE.
+	static SimdFloat LoadBytes(uint8_t const * p)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) p), zero);
+		const __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		const __m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+	}
+	void Store(float * p) const { _mm256_storeu_ps(p, v); }
+
+	SimdFloat operator + (SimdFloat const other) const { return _mm256_add_ps(v, other.v); }
+	SimdFloat operator - (SimdFloat const other) const { return _mm256_sub_ps(v, other.v); }
+	SimdFloat operator * (SimdFloat const other) const { return _mm256_mul_ps(v, other.v); }
+	SimdFloat operator / (SimdFloat const other) const { return _mm256_div_ps(v, other.v); }
+
+	SimdMask operator < (SimdFloat const other) const { return _mm256_cmp_ps(v, other.v, _CMP_LT_OQ); }
+	SimdMask operator <= (SimdFloat const other) const { return _mm256_cmp_ps(v, other.v, _CMP_LE_OQ); }
+	SimdMask operator > (SimdFloat const other) const { return _mm256_cmp_ps(v, other.v, _CMP_GT_OQ); }
+	SimdMask operator >= (SimdFloat const other) const { return _mm256_cmp_ps(v, other.v, _CMP_GE_OQ); }
+	SimdMask operator != (SimdFloat const other) const { return _mm256_cmp_ps(v, other.v, _CMP_NEQ_UQ); }
+
+	static SimdFloat Sqrt(SimdFloat const a) { return _mm256_sqrt_ps(a.v); }
+	static SimdFloat Min(SimdFloat const a, SimdFloat const b) { return _mm256_min_ps(a.v, b.v); }
+	static SimdFloat Max(SimdFloat const a, SimdFloat const b) { return _mm256_max_ps(a.v, b.v); }
+	static SimdFloat Select(SimdMask const mask, SimdFloat const a, SimdFloat const b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+};
+
+#elif defined(RAYTRACER_SIMD_SSE)
+
+static const int SimdWidth = 4;
+
+struct SimdMask
+{
+	__m128 v;
+
+	SimdMask() = default;
+	SimdMask(__m128 const v) : v(v) {}
+
+	SimdMask operator & (SimdMask const other) const { return _mm_and_ps(v, other.v); }
+	SimdMask operator | (SimdMask const other) const { return _mm_or_ps(v, other.v); }
+	SimdMask AndNot(SimdMask const other) const { return _mm_andnot_ps(other.v, v); }
+
+	// One bit per lane, lane 0 in the lowest bit
+	int Bits() const { return _mm_movemask_ps(v); }
+	bool Any() const { return Bits() != 0; }
+};
+
+struct SimdFloat
+{
+	__m128 v;
+
+	SimdFloat() = default;
+	SimdFloat(__m128 const v) : v(v) {}
+	SimdFloat(float const s) : v(_mm_set1_ps(s)) {}
+
+	static SimdFloat Load(float const * p) { return _mm_loadu_ps(p); }
+
+	// Widens SimdWidth unsigned bytes
+	static SimdFloat LoadBytes(uint8_t const * p)
+	{
+		int32_t bytes;
+		memcpy(& bytes, p, sizeof(bytes));
+
+		const __m128i zero = _mm_setzero_si128();
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+	}
+	void Store(float * p) const { _mm_storeu_ps(p, v); }
+
+	SimdFloat operator + (SimdFloat const other) const { return _mm_add_ps(v, other.v); }
+	SimdFloat operator - (SimdFloat const other) const { return _mm_sub_ps(v, other.v); }
+	SimdFloat operator * (SimdFloat const other) const { return _mm_mul_ps(v, other.v); }
+	SimdFloat operator / (SimdFloat const other) const { return _mm_div_ps(v, other.v); }
+
+	SimdMask operator < (SimdFloat const other) const { return _mm_cmplt_ps(v, other.v); }
+	SimdMask operator <= (SimdFloat const other) const { return _mm_cmple_ps(v, other.v); }
+	SimdMask operator > (SimdFloat const other) const { return _mm_cmpgt_ps(v, other.v); }
+	SimdMask operator >= (SimdFloat const other) const { return _mm_cmpge_ps(v, other.v); }
+	SimdMask operator != (SimdFloat const other) const { return _mm_cmpneq_ps(v, other.v); }
+
+	static SimdFloat Sqrt(SimdFloat const a) { return _mm_sqrt_ps(a.v); }
+	static SimdFloat Min(SimdFloat const a, SimdFloat const b) { return _mm_min_ps(a.v, b.v); }
+	static SimdFloat Max(SimdFloat const a, SimdFloat const b) { return _mm_max_ps(a.v, b.v); }
+	static SimdFloat Select(SimdMask const mask, SimdFloat const a, SimdFloat const b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+};
+
+#else
+
+static const int SimdWidth = 4;
+
+struct SimdMask
+{
+	bool v[SimdWidth];
+
+	SimdMask operator & (SimdMask const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] && other.v[i]; return r; }
+	SimdMask operator | (SimdMask const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] || other.v[i]; return r; }
+	SimdMask AndNot(SimdMask const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] && ! other.v[i]; return r; }
+
+	// One bit per lane, lane 0 in the lowest bit
+	int Bits() const { int bits = 0; for (int i = 0; i < SimdWidth; ++ i) bits |= (v[i] ? 1 : 0) << i; return bits; }
+	bool Any() const { return Bits() != 0; }
+};
+
+struct SimdFloat
+{
+	float v[SimdWidth];
+
+	SimdFloat() = default;
+	SimdFloat(float const s) { for (int i = 0; i < SimdWidth; ++ i) v[i] = s; }
+
+	static SimdFloat Load(float const * p) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = p[i]; return r; }
+
+	// Widens SimdWidth unsigned bytes
+	static SimdFloat LoadBytes(uint8_t const * p) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = p[i]; return r; }
+	void Store(float * p) const { for (int i = 0; i < SimdWidth; ++ i) p[i] = v[i]; }
+
+	SimdFloat operator + (SimdFloat const other) const { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] + other.v[i]; return r; }
+	SimdFloat operator - (SimdFloat const other) const { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] - other.v[i]; return r; }
+	SimdFloat operator * (SimdFloat const other) const { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] * other.v[i]; return r; }
+	SimdFloat operator / (SimdFloat const other) const { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] / other.v[i]; return r; }
+
+	SimdMask operator < (SimdFloat const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] < other.v[i]; return r; }
+	SimdMask operator <= (SimdFloat const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] <= other.v[i]; return r; }
+	SimdMask operator > (SimdFloat const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] > other.v[i]; return r; }
+	SimdMask operator >= (SimdFloat const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] >= other.v[i]; return r; }
+	SimdMask operator != (SimdFloat const other) const { SimdMask r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = v[i] != other.v[i]; return r; }
+
+	static SimdFloat Sqrt(SimdFloat const a) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = std::sqrt(a.v[i]); return r; }
+
+	// Like the SSE instructions, these return the second argument if either is NaN
+	static SimdFloat Min(SimdFloat const a, SimdFloat const b) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+	static SimdFloat Max(SimdFloat const a, SimdFloat const b) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+	static SimdFloat Select(SimdMask const mask, SimdFloat const a, SimdFloat const b) { SimdFloat r; for (int i = 0; i < SimdWidth; ++ i) r.v[i] = mask.v[i] ? a.v[i] : b.v[i]; return r; }
+};
+
+#endif
@@ -5,6 +5,8 @@
 
 #include "AABB.hpp"
 
+#include <limits>
+
 
 AABB::AABB()
 {
@@ -49,9 +51,16 @@ void AABB::AddBox(const AABB & other)
 }
 
 float AABB::Intersect(const Ray & ray) const
+{
+	int face;
+	return Intersect(ray, face);
+}
+
+float AABB::Intersect(const Ray & ray, int & outFace) const
 {
 	float largestMin = std::numeric_limits<float>::lowest();
 	float smallestMax = std::numeric_limits<float>::max();
+	int entryFace = -1, exitFace = -1;
 
 	for (int i = 0; i < 3; ++ i)
 	{
@@ -67,11 +76,27 @@ float AABB::Intersect(const Ray & ray) const
 			float tmin = (min[i] - ray.origin[i]) / ray.direction[i];
 			float tmax = (max[i] - ray.origin[i]) / ray.direction[i];
 
+			// Faces are numbered axis * 2, plus one for the face at the maximum
+			int tminFace = i * 2;
+			int tmaxFace = i * 2 + 1;
+
 			if (tmin > tmax)
+			{
 				std::swap(tmin, tmax);
+				std::swap(tminFace, tmaxFace);
+			}
+
+			if (tmin > largestMin)
+			{
+				largestMin = tmin;
+				entryFace = tminFace;
+			}
 
-			largestMin = glm::max(tmin, largestMin);
-			smallestMax = glm::min(tmax, smallestMax);
+			if (tmax < smallestMax)
+			{
+				smallestMax = tmax;
+				exitFace = tmaxFace;
+			}
 		}
 	}
 
@@ -82,9 +107,65 @@ float AABB::Intersect(const Ray & ray) const
 		return -1;
 
 	if (largestMin > 0)
+	{
+		outFace = entryFace;
 		return largestMin;
+	}
 	else
+	{
+		outFace = exitFace;
 		return smallestMax;
+	}
+}
+
+namespace
+{
+
+	// Shared by both slab tests, so that the one without an exit point doesn't pay for a call
+	inline bool IntersectSlabs(const glm::vec3 & min, const glm::vec3 & max, const PrecomputedRay & ray, const float tMax, float & outEntry, float & outExit)
+	{
+		static const float epsilon = 1e-6f;
+
+		const glm::vec3 * const bounds[2] = { & min, & max };
+
+		float tmin = std::numeric_limits<float>::lowest();
+		float tmax = std::numeric_limits<float>::max();
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			const float axisMin = ((* bounds[ray.sign[i]])[i] - ray.origin[i]) * ray.inverseDirection[i];
+			const float axisMax = ((* bounds[1 - ray.sign[i]])[i] - ray.origin[i]) * ray.inverseDirection[i];
+
+			// Written so that a NaN (zero direction with the origin on a slab boundary) leaves the interval unchanged
+			if (axisMin > tmin)
+				tmin = axisMin;
+			if (axisMax < tmax)
+				tmax = axisMax;
+		}
+
+		// Widen the interval slightly so rounding never culls a primitive lying on the box surface
+		tmin *= tmin > 0 ? 1.f - epsilon : 1.f + epsilon;
+		tmax *= tmax > 0 ? 1.f + epsilon : 1.f - epsilon;
+
+		if (tmin > tmax || tmax < 0 || tmin > tMax)
+			return false;
+
+		outEntry = glm::max(tmin, 0.f);
+		outExit = tmax;
+		return true;
+	}
+
+}
+
+bool AABB::Intersect(const PrecomputedRay & ray, const float tMax, float & outEntry) const
+{
+	float exit;
+	return IntersectSlabs(min, max, ray, tMax, outEntry, exit);
+}
+
+bool AABB::Intersect(const PrecomputedRay & ray, const float tMax, float & outEntry, float & outExit) const
+{
+	return IntersectSlabs(min, max, ray, tMax, outEntry, outExit);
 }
 
 glm::vec3 AABB::GetCenter() const
@@ -92,6 +173,12 @@ glm::vec3 AABB::GetCenter() const
 	return (max + min) / 2.f;
 }
 
+float AABB::GetSurfaceArea() const
+{
+	const glm::vec3 extent = max - min;
+	return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
 void AABB::Transform(const glm::mat4 & m)
 {
 	glm::vec3 vertices[8] =
@@ -26,7 +26,13 @@ public:
 	void AddBox(const AABB & other);
 
 	float Intersect(const Ray & ray) const;
+	float Intersect(const Ray & ray, int & outFace) const;
+	bool Intersect(const PrecomputedRay & ray, const float tMax, float & outEntry) const;
+
+	// Also returns where the ray leaves the box
+	bool Intersect(const PrecomputedRay & ray, const float tMax, float & outEntry, float & outExit) const;
 	glm::vec3 GetCenter() const;
+	float GetSurfaceArea() const;
 
 	void Transform(const glm::mat4 & m);
 
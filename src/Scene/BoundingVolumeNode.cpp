@@ -5,125 +5,1010 @@
 
 #include "BoundingVolumeNode.hpp"
 
+#include <Objects/Triangle.hpp>
+#include <RayTracer/Simd.hpp>
+
 #include <iostream>
 #include <algorithm>
+#include <limits>
+#include <thread>
+
+
+const float BoundingVolumeNode::LeafTestTraversalCost = 1.f;
+const float BoundingVolumeNode::SpatialSplitOverlap = 1e-5f;
+
+BoundingVolumeNode::~BoundingVolumeNode()
+{
+	for (BoundingVolumeNode * child : children)
+	{
+		delete child;
+	}
+}
+
+BoundingVolumeNode * BoundingVolumeNode::Build(const std::vector<const Object *> & objects, const BvhBuildMethod method, const size_t leafSize, const float spatialSplitBudget, const int threadCount)
+{
+	BoundingVolumeNode * root = new BoundingVolumeNode();
+
+	if (objects.empty())
+	{
+		return root;
+	}
+
+	std::vector<BuildPrimitive> primitives(objects.size());
+
+	for (size_t i = 0; i < objects.size(); ++ i)
+	{
+		primitives[i].box = objects[i]->GetBoundingBox();
+		primitives[i].center = primitives[i].box.GetCenter();
+		primitives[i].object = objects[i];
+	}
+
+	BuildPrimitive * begin = primitives.data();
+	BuildPrimitive * end = begin + primitives.size();
+
+	switch (method)
+	{
+	case BvhBuildMethod::Median:
+		root->BuildMedian(begin, end, 0, leafSize, threadCount);
+		break;
+
+	case BvhBuildMethod::SurfaceAreaHeuristic:
+		root->BuildSAH(begin, end, leafSize, threadCount);
+		break;
+
+	case BvhBuildMethod::Morton:
+	{
+		// Sorting replaces the array of primitives
+		std::vector<uint64_t> codes;
+		SortByMortonCode(primitives, codes);
+
+		begin = primitives.data();
+		end = begin + primitives.size();
+		root->BuildMorton(begin, end, codes.data(), leafSize, threadCount);
+		break;
+	}
+
+	case BvhBuildMethod::SpatialSplit:
+	{
+		const float rootArea = ComputeBoundingBox(begin, end).GetSurfaceArea();
+		const size_t splitBudget = (size_t) (spatialSplitBudget * objects.size());
+
+		root->BuildSpatialSplit(begin, end, rootArea, splitBudget, leafSize, threadCount);
+		break;
+	}
+	}
 
+	return root;
+}
 
-BoundingVolumeNode::BoundingVolumeNode(const std::vector<const Object *> & objects)
+int BoundingVolumeNode::GetMortonCodeBits(const size_t objectCount)
 {
-	this->objects = objects;
-	this->box = ComputeBoundingBox(objects);
+	return objectCount > MortonCode30BitLimit ? 63 : 30;
+}
+
+namespace
+{
+
+	// Spreads the low 10 bits of v out so that there are two zero bits between each of them
+	uint64_t ExpandBits10(uint64_t v)
+	{
+		v &= 0x3ff;
+		v = (v | v << 16) & 0x30000ff;
+		v = (v | v << 8) & 0x300f00f;
+		v = (v | v << 4) & 0x30c30c3;
+		v = (v | v << 2) & 0x9249249;
+		return v;
+	}
+
+	// Spreads the low 21 bits of v out so that there are two zero bits between each of them
+	uint64_t ExpandBits21(uint64_t v)
+	{
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffff;
+		v = (v | v << 16) & 0x1f0000ff0000ff;
+		v = (v | v << 8) & 0x100f00f00f00f00f;
+		v = (v | v << 4) & 0x10c30c30c30c30c3;
+		v = (v | v << 2) & 0x1249249249249249;
+		return v;
+	}
+
+}
+
+void BoundingVolumeNode::SortByMortonCode(std::vector<BuildPrimitive> & primitives, std::vector<uint64_t> & outCodes)
+{
+	struct Key
+	{
+		uint64_t code;
+		uint32_t index;
+	};
+
+	const int codeBits = GetMortonCodeBits(primitives.size());
+	const int axisBits = codeBits / 3;
+	const float cellCount = (float) ((1 << axisBits) - 1);
+
+	AABB centroidBox;
+	for (const BuildPrimitive & primitive : primitives)
+	{
+		centroidBox.AddPoint(primitive.center);
+	}
+
+	const glm::vec3 extent = centroidBox.max - centroidBox.min;
+
+	std::vector<Key> keys(primitives.size()), sorted(primitives.size());
+
+	for (size_t i = 0; i < primitives.size(); ++ i)
+	{
+		uint64_t cell[3];
+
+		for (int axis = 0; axis < 3; ++ axis)
+		{
+			const float offset = extent[axis] > 0 ? (primitives[i].center[axis] - centroidBox.min[axis]) / extent[axis] : 0.f;
+			cell[axis] = (uint64_t) glm::clamp(offset * cellCount, 0.f, cellCount);
+		}
+
+		if (axisBits == 10)
+		{
+			keys[i].code = ExpandBits10(cell[0]) << 2 | ExpandBits10(cell[1]) << 1 | ExpandBits10(cell[2]);
+		}
+		else
+		{
+			keys[i].code = ExpandBits21(cell[0]) << 2 | ExpandBits21(cell[1]) << 1 | ExpandBits21(cell[2]);
+		}
+
+		keys[i].index = (uint32_t) i;
+	}
+
+	// Least significant digit radix sort, one byte per pass
+	static const int RadixBits = 8;
+	static const int BucketCount = 1 << RadixBits;
+
+	for (int shift = 0; shift < codeBits; shift += RadixBits)
+	{
+		size_t bucketStart[BucketCount] = {};
+
+		for (const Key & key : keys)
+		{
+			bucketStart[(key.code >> shift) & (BucketCount - 1)] ++;
+		}
+
+		size_t total = 0;
+		for (int bucket = 0; bucket < BucketCount; ++ bucket)
+		{
+			const size_t count = bucketStart[bucket];
+			bucketStart[bucket] = total;
+			total += count;
+		}
+
+		for (const Key & key : keys)
+		{
+			sorted[bucketStart[(key.code >> shift) & (BucketCount - 1)] ++] = key;
+		}
+
+		keys.swap(sorted);
+	}
+
+	std::vector<BuildPrimitive> reordered(primitives.size());
+	outCodes.resize(primitives.size());
+
+	for (size_t i = 0; i < keys.size(); ++ i)
+	{
+		reordered[i] = primitives[keys[i].index];
+		outCodes[i] = keys[i].code;
+	}
+
+	primitives.swap(reordered);
 }
 
-AABB BoundingVolumeNode::ComputeBoundingBox(const std::vector<const Object *> & objects)
+AABB BoundingVolumeNode::ComputeBoundingBox(const BuildPrimitive * begin, const BuildPrimitive * end)
 {
 	AABB box;
 
-	for (const Object * object : objects)
+	for (const BuildPrimitive * primitive = begin; primitive != end; ++ primitive)
 	{
-		box.AddBox(object->GetBoundingBox());
+		box.AddBox(primitive->box);
 	}
 
 	return box;
 }
 
-void BoundingVolumeNode::SortObjects(const int axis)
+void BoundingVolumeNode::ForEachChunk(BuildPrimitive * begin, BuildPrimitive * end, const int chunkCount, const std::function<void(const int chunk, BuildPrimitive * begin, BuildPrimitive * end)> & function)
 {
-	struct Sorter
+	const size_t count = end - begin;
+
+	// The calling thread takes the first chunk
+	std::vector<std::thread> threads;
+
+	for (int chunk = 1; chunk < chunkCount; ++ chunk)
 	{
+		threads.push_back(std::thread(function, chunk, begin + count * chunk / chunkCount, begin + count * (chunk + 1) / chunkCount));
+	}
+
+	function(0, begin, begin + count / chunkCount);
 
-		static bool ByX(const Object * b1, const Object * b2)
+	for (std::thread & thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void BoundingVolumeNode::MakeLeaf(const BuildPrimitive * begin, const BuildPrimitive * end)
+{
+	for (const BuildPrimitive * primitive = begin; primitive != end; ++ primitive)
+	{
+		objects.push_back(primitive->object);
+	}
+}
+
+void BoundingVolumeNode::BuildChildren(BuildPrimitive * begin, BuildPrimitive * middle, BuildPrimitive * end, const int threadCount, const BuildFunction & build)
+{
+	children.push_back(new BoundingVolumeNode());
+	children.push_back(new BoundingVolumeNode());
+
+	if (threadCount > 1 && (size_t) (end - begin) >= ParallelBuildThreshold)
+	{
+		// The subtrees cover disjoint ranges, so they can be built independently, splitting the threads between them
+		const int leftThreadCount = threadCount / 2;
+
+		std::thread left(build, children[0], begin, middle, leftThreadCount);
+		build(children[1], middle, end, threadCount - leftThreadCount);
+		left.join();
+	}
+	else
+	{
+		build(children[0], begin, middle, 1);
+		build(children[1], middle, end, 1);
+	}
+}
+
+void BoundingVolumeNode::BuildMedian(BuildPrimitive * begin, BuildPrimitive * end, const int axis, const size_t leafSize, const int threadCount)
+{
+	box = ComputeBoundingBox(begin, end);
+
+	if ((size_t) (end - begin) <= leafSize)
+	{
+		MakeLeaf(begin, end);
+		return;
+	}
+
+	std::sort(begin, end, [axis](const BuildPrimitive & p1, const BuildPrimitive & p2)
+	{
+		return p1.center[axis] < p2.center[axis];
+	});
+
+	BuildChildren(begin, begin + (end - begin) / 2, end, threadCount, [axis, leafSize](BoundingVolumeNode * child, BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)
+	{
+		child->BuildMedian(begin, end, (axis + 1) % 3, leafSize, threadCount);
+	});
+}
+
+int BoundingVolumeNode::GetBinIndex(const BuildPrimitive & primitive, const AABB & centroidBox, const int axis)
+{
+	const float extent = centroidBox.max[axis] - centroidBox.min[axis];
+	const float offset = primitive.center[axis] - centroidBox.min[axis];
+	return glm::min((int) (SAHBinCount * offset / extent), SAHBinCount - 1);
+}
+
+BoundingVolumeNode::ObjectSplit BoundingVolumeNode::FindObjectSplit(BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)
+{
+	const size_t count = end - begin;
+
+	struct Bin
+	{
+		AABB box;
+		size_t count = 0;
+	};
+
+	struct ChunkBounds
+	{
+		AABB box;
+		AABB centroidBox;
+	};
+
+	ObjectSplit split;
+
+	const int chunkCount = count < ParallelBuildThreshold ? 1 : glm::max(threadCount, 1);
+
+	// Each chunk collects its own bounds and bins, which are merged afterwards
+	std::vector<ChunkBounds> chunkBounds(chunkCount);
+
+	ForEachChunk(begin, end, chunkCount, [&](const int chunk, BuildPrimitive * chunkBegin, BuildPrimitive * chunkEnd)
+	{
+		for (const BuildPrimitive * primitive = chunkBegin; primitive != chunkEnd; ++ primitive)
 		{
-			return b1->GetBoundingBox().GetCenter().x < b2->GetBoundingBox().GetCenter().x;
-		};
+			chunkBounds[chunk].box.AddBox(primitive->box);
+			chunkBounds[chunk].centroidBox.AddPoint(primitive->center);
+		}
+	});
+
+	for (const ChunkBounds & bounds : chunkBounds)
+	{
+		split.box.AddBox(bounds.box);
+		split.centroidBox.AddBox(bounds.centroidBox);
+	}
 
-		static bool ByY(const Object * b1, const Object * b2)
+	const AABB & centroidBox = split.centroidBox;
+	std::vector<Bin> chunkBins(chunkCount * 3 * SAHBinCount);
+
+	ForEachChunk(begin, end, chunkCount, [&](const int chunk, BuildPrimitive * chunkBegin, BuildPrimitive * chunkEnd)
+	{
+		for (int axis = 0; axis < 3; ++ axis)
 		{
-			return b1->GetBoundingBox().GetCenter().y < b2->GetBoundingBox().GetCenter().y;
-		};
+			if (centroidBox.max[axis] <= centroidBox.min[axis])
+				continue;
+
+			Bin * const bins = & chunkBins[(chunk * 3 + axis) * SAHBinCount];
 
-		static bool ByZ(const Object * b1, const Object * b2)
+			for (const BuildPrimitive * primitive = chunkBegin; primitive != chunkEnd; ++ primitive)
+			{
+				Bin & bin = bins[GetBinIndex(* primitive, centroidBox, axis)];
+				bin.box.AddBox(primitive->box);
+				bin.count ++;
+			}
+		}
+	});
+
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		if (centroidBox.max[axis] <= centroidBox.min[axis])
+			continue;
+
+		Bin bins[SAHBinCount];
+		for (int chunk = 0; chunk < chunkCount; ++ chunk)
 		{
-			return b1->GetBoundingBox().GetCenter().z < b2->GetBoundingBox().GetCenter().z;
-		};
+			for (int i = 0; i < SAHBinCount; ++ i)
+			{
+				const Bin & chunkBin = chunkBins[(chunk * 3 + axis) * SAHBinCount + i];
+				bins[i].box.AddBox(chunkBin.box);
+				bins[i].count += chunkBin.count;
+			}
+		}
+
+		// Sweep from the right to find the cost of every right-hand side,
+		// then from the left to combine it with each left-hand side
+		float rightCost[SAHBinCount];
+		AABB rightBoxes[SAHBinCount];
+		AABB rightBox;
+		size_t rightCount = 0;
+
+		for (int i = SAHBinCount - 1; i > 0; -- i)
+		{
+			rightBox.AddBox(bins[i].box);
+			rightCount += bins[i].count;
+			rightCost[i] = rightCount ? rightBox.GetSurfaceArea() * rightCount : -1;
+			rightBoxes[i] = rightBox;
+		}
+
+		AABB leftBox;
+		size_t leftCount = 0;
+
+		for (int i = 0; i < SAHBinCount - 1; ++ i)
+		{
+			leftBox.AddBox(bins[i].box);
+			leftCount += bins[i].count;
+
+			if (leftCount == 0 || rightCost[i + 1] < 0)
+				continue;
+
+			const float cost = leftBox.GetSurfaceArea() * leftCount + rightCost[i + 1];
+			if (cost < split.cost)
+			{
+				split.cost = cost;
+				split.axis = axis;
+				split.bin = i;
+				split.leftCount = leftCount;
+				split.rightCount = count - leftCount;
+				split.leftBox = leftBox;
+				split.rightBox = rightBoxes[i + 1];
+			}
+		}
+	}
+
+	return split;
+}
+
+BoundingVolumeNode::BuildPrimitive * BoundingVolumeNode::PartitionObjectSplit(BuildPrimitive * begin, BuildPrimitive * end, const ObjectSplit & split)
+{
+	// If all centroids coincide, no plane separates them and the range is just split in half
+	if (split.axis < 0)
+	{
+		return begin + (end - begin) / 2;
+	}
+
+	return std::partition(begin, end, [&](const BuildPrimitive & primitive)
+	{
+		return GetBinIndex(primitive, split.centroidBox, split.axis) <= split.bin;
+	});
+}
+
+float BoundingVolumeNode::GetLeafCost(const size_t (& typeCounts)[PrimitivePools::TypeCount])
+{
+	float cost = 0.f;
+	int typeGroups = 0;
+
+	for (int type = 0; type < PrimitivePools::TypeCount; ++ type)
+	{
+		if (typeCounts[type])
+		{
+			cost += (float) ((typeCounts[type] + SimdWidth - 1) / SimdWidth);
+			typeGroups ++;
+		}
+	}
+
+	return cost + glm::max(typeGroups - 1, 0) * LeafTestTraversalCost;
+}
+
+bool BoundingVolumeNode::IsLeafCheaper(const BuildPrimitive * begin, const BuildPrimitive * end, const ObjectSplit & split)
+{
+	const float area = split.box.GetSurfaceArea();
+
+	// Nothing separates the objects, so splitting them gains nothing
+	if (split.axis < 0 || area <= 0)
+	{
+		return true;
+	}
+
+	// Sorted into the sides of the split the same way PartitionObjectSplit will
+	size_t typeCounts[PrimitivePools::TypeCount] = {}, leftTypeCounts[PrimitivePools::TypeCount] = {}, rightTypeCounts[PrimitivePools::TypeCount] = {};
+
+	for (const BuildPrimitive * primitive = begin; primitive < end; ++ primitive)
+	{
+		const int type = (int) PrimitivePools::Classify(primitive->object);
+		typeCounts[type] ++;
+
+		if (GetBinIndex(* primitive, split.centroidBox, split.axis) <= split.bin)
+		{
+			leftTypeCounts[type] ++;
+		}
+		else
+		{
+			rightTypeCounts[type] ++;
+		}
+	}
+
+	// Each child is costed as if it became a leaf
+	const float splitCost = LeafTestTraversalCost + (split.leftBox.GetSurfaceArea() * GetLeafCost(leftTypeCounts) + split.rightBox.GetSurfaceArea() * GetLeafCost(rightTypeCounts)) / area;
+	return GetLeafCost(typeCounts) <= splitCost;
+}
+
+void BoundingVolumeNode::BuildSAH(BuildPrimitive * begin, BuildPrimitive * end, const size_t leafSize, const int threadCount)
+{
+	const size_t count = end - begin;
+
+	if (count <= 1)
+	{
+		box = ComputeBoundingBox(begin, end);
+		MakeLeaf(begin, end);
+		return;
+	}
+
+	const ObjectSplit split = FindObjectSplit(begin, end, threadCount);
+	box = split.box;
+
+	if (count <= leafSize && IsLeafCheaper(begin, end, split))
+	{
+		MakeLeaf(begin, end);
+		return;
+	}
+
+	BuildChildren(begin, PartitionObjectSplit(begin, end, split), end, threadCount, [leafSize](BoundingVolumeNode * child, BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)
+	{
+		child->BuildSAH(begin, end, leafSize, threadCount);
+	});
+}
+
+void BoundingVolumeNode::BuildMorton(BuildPrimitive * begin, BuildPrimitive * end, const uint64_t * codes, const size_t leafSize, const int threadCount)
+{
+	const size_t count = end - begin;
+
+	if (count <= leafSize)
+	{
+		box = ComputeBoundingBox(begin, end);
+		MakeLeaf(begin, end);
+		return;
+	}
+
+	// Split where the highest bit that differs within the range flips from zero to one.
+	// Objects sharing a single code cannot be separated this way and are split in half.
+	size_t split = count / 2;
+	const uint64_t differingBits = codes[0] ^ codes[count - 1];
+
+	if (differingBits)
+	{
+		int bit = 63;
+		while (! ((differingBits >> bit) & 1))
+		{
+			-- bit;
+		}
+
+		// The codes are sorted, so the objects with the bit set form a suffix of the range
+		size_t low = 0, high = count - 1;
+		while (low < high)
+		{
+			const size_t middle = (low + high) / 2;
+
+			if ((codes[middle] >> bit) & 1)
+			{
+				high = middle;
+			}
+			else
+			{
+				low = middle + 1;
+			}
+		}
+
+		split = low;
+	}
+
+	BuildChildren(begin, begin + split, end, threadCount, [begin, codes, leafSize](BoundingVolumeNode * child, BuildPrimitive * childBegin, BuildPrimitive * childEnd, const int threadCount)
+	{
+		child->BuildMorton(childBegin, childEnd, codes + (childBegin - begin), leafSize, threadCount);
+	});
+
+	// Bounds are gathered bottom-up so that each object is only visited once
+	box = children[0]->GetBoundingBox();
+	box.AddBox(children[1]->GetBoundingBox());
+}
+
+namespace
+{
+
+	bool IsEmpty(const AABB & box)
+	{
+		return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+	}
+
+	float GetOverlapArea(const AABB & a, const AABB & b)
+	{
+		const glm::vec3 extent = glm::max(glm::min(a.max, b.max) - glm::max(a.min, b.min), glm::vec3(0.f));
+		return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+}
+
+AABB BoundingVolumeNode::ClipReference(const BuildPrimitive & reference, const int axis, const float low, const float high)
+{
+	AABB clipped;
+
+	if (reference.object->GetType() == ObjectType::Triangle)
+	{
+		// Bound the part of the triangle between the two planes: its vertices inside them, and where its edges cross them
+		const Triangle * triangle = static_cast<const Triangle *>(reference.object);
+		const glm::mat4 & modelMatrix = triangle->GetModelMatrix();
+
+		const float planes[2] = {low, high};
+
+		glm::vec3 vertices[3];
+		for (int i = 0; i < 3; ++ i)
+		{
+			vertices[i] = glm::vec3(modelMatrix * glm::vec4(triangle->GetVertex(i), 1.f));
+		}
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			const glm::vec3 & p = vertices[i];
+			const glm::vec3 & q = vertices[(i + 1) % 3];
+
+			if (p[axis] >= low && p[axis] <= high)
+			{
+				clipped.AddPoint(p);
+			}
+
+			for (const float plane : planes)
+			{
+				if ((p[axis] < plane && q[axis] > plane) || (p[axis] > plane && q[axis] < plane))
+				{
+					glm::vec3 crossing = p + (q - p) * ((plane - p[axis]) / (q[axis] - p[axis]));
+					crossing[axis] = plane;
+					clipped.AddPoint(crossing);
+				}
+			}
+		}
+	}
+	else
+	{
+		// Other shapes are only clipped through their bounding box
+		clipped = reference.box;
+	}
+
+	// A reference that was already clipped higher up the tree must not grow back
+	clipped.min = glm::max(clipped.min, reference.box.min);
+	clipped.max = glm::min(clipped.max, reference.box.max);
+	clipped.min[axis] = glm::max(clipped.min[axis], low);
+	clipped.max[axis] = glm::min(clipped.max[axis], high);
+
+	return clipped;
+}
 
+BoundingVolumeNode::SpatialSplit BoundingVolumeNode::FindSpatialSplit(const BuildPrimitive * begin, const BuildPrimitive * end, const AABB & box)
+{
+	// Every reference enters the first bin it overlaps and exits the last,
+	// adding its clipped bounds to each bin in between
+	struct Bin
+	{
+		AABB box;
+		size_t entries = 0;
+		size_t exits = 0;
 	};
 
-	switch (axis)
+	SpatialSplit split;
+
+	for (int axis = 0; axis < 3; ++ axis)
 	{
-	default:
-	case 0:
-		std::sort(objects.begin(), objects.end(), Sorter::ByX);
-		break;
+		const float extent = box.max[axis] - box.min[axis];
 
-	case 1:
-		std::sort(objects.begin(), objects.end(), Sorter::ByY);
-		break;
+		if (extent <= 0)
+			continue;
 
-	case 2:
-		std::sort(objects.begin(), objects.end(), Sorter::ByZ);
-		break;
+		const float binWidth = extent / SpatialBinCount;
+
+		auto GetBin = [&](const float position)
+		{
+			return glm::clamp((int) ((position - box.min[axis]) / binWidth), 0, SpatialBinCount - 1);
+		};
+
+		Bin bins[SpatialBinCount];
+
+		for (const BuildPrimitive * primitive = begin; primitive != end; ++ primitive)
+		{
+			const int first = GetBin(primitive->box.min[axis]);
+			const int last = glm::max(GetBin(primitive->box.max[axis]), first);
+
+			bins[first].entries ++;
+			bins[last].exits ++;
+
+			if (first == last)
+			{
+				bins[first].box.AddBox(primitive->box);
+				continue;
+			}
+
+			for (int i = first; i <= last; ++ i)
+			{
+				const float low = i == first ? primitive->box.min[axis] : box.min[axis] + binWidth * i;
+				const float high = i == last ? primitive->box.max[axis] : box.min[axis] + binWidth * (i + 1);
+
+				bins[i].box.AddBox(ClipReference(* primitive, axis, low, high));
+			}
+		}
+
+		AABB rightBoxes[SpatialBinCount];
+		size_t rightCounts[SpatialBinCount];
+		AABB rightBox;
+		size_t rightCount = 0;
+
+		for (int i = SpatialBinCount - 1; i > 0; -- i)
+		{
+			rightBox.AddBox(bins[i].box);
+			rightCount += bins[i].exits;
+			rightBoxes[i] = rightBox;
+			rightCounts[i] = rightCount;
+		}
+
+		AABB leftBox;
+		size_t leftCount = 0;
+
+		for (int i = 0; i < SpatialBinCount - 1; ++ i)
+		{
+			leftBox.AddBox(bins[i].box);
+			leftCount += bins[i].entries;
+
+			if (leftCount == 0 || rightCounts[i + 1] == 0)
+				continue;
+
+			const float cost = leftBox.GetSurfaceArea() * leftCount + rightBoxes[i + 1].GetSurfaceArea() * rightCounts[i + 1];
+			if (cost < split.cost)
+			{
+				split.cost = cost;
+				split.axis = axis;
+				split.position = box.min[axis] + binWidth * (i + 1);
+				split.leftCount = leftCount;
+				split.rightCount = rightCounts[i + 1];
+				split.leftBox = leftBox;
+				split.rightBox = rightBoxes[i + 1];
+			}
+		}
 	}
+
+	return split;
 }
 
-void BoundingVolumeNode::BuildTree(const int axis)
+size_t BoundingVolumeNode::PartitionSpatialSplit(const BuildPrimitive * begin, const BuildPrimitive * end, const SpatialSplit & split, std::vector<BuildPrimitive> & outReferences)
 {
-	if (objects.size() <= 1)
+	const int axis = split.axis;
+
+	std::vector<BuildPrimitive> left, right;
+	AABB leftBox = split.leftBox, rightBox = split.rightBox;
+	float leftCount = (float) split.leftCount, rightCount = (float) split.rightCount;
+
+	for (const BuildPrimitive * primitive = begin; primitive != end; ++ primitive)
+	{
+		if (primitive->box.max[axis] <= split.position)
+		{
+			left.push_back(* primitive);
+			continue;
+		}
+
+		if (primitive->box.min[axis] >= split.position)
+		{
+			right.push_back(* primitive);
+			continue;
+		}
+
+		BuildPrimitive leftPart = * primitive, rightPart = * primitive;
+		leftPart.box = ClipReference(* primitive, axis, primitive->box.min[axis], split.position);
+		rightPart.box = ClipReference(* primitive, axis, split.position, primitive->box.max[axis]);
+		leftPart.center = leftPart.box.GetCenter();
+		rightPart.center = rightPart.box.GetCenter();
+
+		// The object may not actually reach across the plane within its box
+		if (IsEmpty(rightPart.box))
+		{
+			left.push_back(leftPart);
+			continue;
+		}
+
+		if (IsEmpty(leftPart.box))
+		{
+			right.push_back(rightPart);
+			continue;
+		}
+
+		// Keep the whole reference on one side instead if that is no more expensive than duplicating it
+		AABB leftUnsplit = leftBox, rightUnsplit = rightBox;
+		leftUnsplit.AddBox(primitive->box);
+		rightUnsplit.AddBox(primitive->box);
+
+		const float splitCost = leftBox.GetSurfaceArea() * leftCount + rightBox.GetSurfaceArea() * rightCount;
+		const float leftCost = leftUnsplit.GetSurfaceArea() * leftCount + rightBox.GetSurfaceArea() * (rightCount - 1);
+		const float rightCost = leftBox.GetSurfaceArea() * (leftCount - 1) + rightUnsplit.GetSurfaceArea() * rightCount;
+
+		if (leftCost <= splitCost && leftCost <= rightCost)
+		{
+			left.push_back(* primitive);
+			leftBox = leftUnsplit;
+			rightCount -= 1;
+		}
+		else if (rightCost <= splitCost)
+		{
+			right.push_back(* primitive);
+			rightBox = rightUnsplit;
+			leftCount -= 1;
+		}
+		else
+		{
+			left.push_back(leftPart);
+			right.push_back(rightPart);
+		}
+	}
+
+	outReferences = left;
+	outReferences.insert(outReferences.end(), right.begin(), right.end());
+	return left.size();
+}
+
+void BoundingVolumeNode::BuildSpatialSplit(BuildPrimitive * begin, BuildPrimitive * end, const float rootArea, const size_t splitBudget, const size_t leafSize, const int threadCount)
+{
+	const size_t count = end - begin;
+
+	if (count <= 1)
+	{
+		box = ComputeBoundingBox(begin, end);
+		MakeLeaf(begin, end);
 		return;
+	}
 
-	SortObjects(axis);
+	const ObjectSplit objectSplit = FindObjectSplit(begin, end, threadCount);
+	box = objectSplit.box;
 
-	children.push_back(new BoundingVolumeNode(std::vector<const Object *>(
-		objects.begin(),
-		objects.begin() + objects.size() / 2)));
-	children.push_back(new BoundingVolumeNode(std::vector<const Object *>(
-		objects.begin() + objects.size() / 2,
-		objects.end())));
-	
-	objects.clear();
+	if (count <= leafSize && IsLeafCheaper(begin, end, objectSplit))
+	{
+		MakeLeaf(begin, end);
+		return;
+	}
 
-	for (BoundingVolumeNode * child : children)
+	// Spatial splits only pay off where the object split leaves children that overlap
+	SpatialSplit spatialSplit;
+
+	if (splitBudget > 0 && (objectSplit.axis < 0 || GetOverlapArea(objectSplit.leftBox, objectSplit.rightBox) > SpatialSplitOverlap * rootArea))
+	{
+		spatialSplit = FindSpatialSplit(begin, end, box);
+	}
+
+	if (spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost && spatialSplit.leftCount + spatialSplit.rightCount - count <= splitBudget)
 	{
-		child->BuildTree((axis + 1) % 3);
+		// Duplicated references no longer fit in this node's range, so the children get their own array
+		std::vector<BuildPrimitive> references;
+		const size_t leftCount = PartitionSpatialSplit(begin, end, spatialSplit, references);
+		const size_t total = references.size();
+
+		if (leftCount > 0 && leftCount < total)
+		{
+			const size_t remainingBudget = splitBudget - (total - count);
+
+			// The budget is shared out by size, so the tree does not depend on which subtree is built first
+			BuildChildren(references.data(), references.data() + leftCount, references.data() + total, threadCount, [=](BoundingVolumeNode * child, BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)
+			{
+				child->BuildSpatialSplit(begin, end, rootArea, remainingBudget * (end - begin) / total, leafSize, threadCount);
+			});
+			return;
+		}
 	}
+
+	BuildChildren(begin, PartitionObjectSplit(begin, end, objectSplit), end, threadCount, [=](BoundingVolumeNode * child, BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)
+	{
+		child->BuildSpatialSplit(begin, end, rootArea, splitBudget * (end - begin) / count, leafSize, threadCount);
+	});
 }
 
-bool BoundingVolumeNode::Intersect(const Ray & ray, float & outIntersect, const Object * & outObject) const
+float BoundingVolumeNode::GetSAHCost() const
 {
-	if (box.Intersect(ray) < 0)
+	const float rootArea = box.GetSurfaceArea();
+	return rootArea > 0 ? GetSubtreeCost() / rootArea : 0.f;
+}
+
+float BoundingVolumeNode::GetSubtreeCost() const
+{
+	if (children.empty())
 	{
-		return false;
+		return box.GetSurfaceArea() * objects.size();
 	}
 
-	for (const BoundingVolumeNode * child : children)
+	return box.GetSurfaceArea() + children[0]->GetSubtreeCost() + children[1]->GetSubtreeCost();
+}
+
+void BoundingVolumeNode::RestructureTreelets(const int passCount, const int threadCount)
+{
+	for (int pass = 0; pass < passCount; ++ pass)
 	{
-		float newT;
-		const Object * newObject = nullptr;
+		RestructurePass(threadCount);
+	}
+}
+
+void BoundingVolumeNode::RestructurePass(const int threadCount)
+{
+	if (children.empty())
+	{
+		cost = box.GetSurfaceArea() * objects.size();
+		return;
+	}
+
+	// A treelet only reaches into its root's own subtree, so the two subtrees never touch the same nodes
+	if (threadCount > 1)
+	{
+		const int leftThreadCount = threadCount / 2;
+
+		std::thread left(& BoundingVolumeNode::RestructurePass, children[0], leftThreadCount);
+		children[1]->RestructurePass(threadCount - leftThreadCount);
+		left.join();
+	}
+	else
+	{
+		children[0]->RestructurePass(1);
+		children[1]->RestructurePass(1);
+	}
 
-		if (child->Intersect(ray, newT, newObject))
+	cost = box.GetSurfaceArea() + children[0]->cost + children[1]->cost;
+	RestructureTreelet();
+}
+
+void BoundingVolumeNode::RestructureTreelet()
+{
+	// Grow the treelet by repeatedly opening its interior leaf with the largest surface area
+	std::vector<BoundingVolumeNode *> leaves = children;
+	std::vector<BoundingVolumeNode *> interior;
+
+	while (leaves.size() < TreeletSize)
+	{
+		int largest = -1;
+
+		for (int i = 0; i < (int) leaves.size(); ++ i)
 		{
-			if (outObject == nullptr || newT < outIntersect)
+			if (leaves[i]->children.size() && (largest < 0 || leaves[i]->box.GetSurfaceArea() > leaves[largest]->box.GetSurfaceArea()))
 			{
-				outObject = newObject;
-				outIntersect = newT;
+				largest = i;
 			}
 		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		BoundingVolumeNode * const opened = leaves[largest];
+		interior.push_back(opened);
+		leaves[largest] = opened->children[0];
+		leaves.push_back(opened->children[1]);
 	}
 
-	for (const Object * object : objects)
+	if (leaves.size() < 3)
 	{
-		float t = object->IntersectTransformed(ray);
-		if (t >= 0)
+		return;
+	}
+
+	// Find the cheapest binary tree over every subset of the leaves, smallest subsets first.
+	// Every proper subset of a set has a lower bit mask than the set itself.
+	const int leafCount = (int) leaves.size();
+	const int subsetCount = 1 << leafCount;
+
+	std::vector<AABB> subsetBoxes(subsetCount);
+	std::vector<float> subsetCosts(subsetCount);
+	std::vector<int> subsetSplits(subsetCount);
+
+	for (int subset = 1; subset < subsetCount; ++ subset)
+	{
+		const int lowestBit = subset & -subset;
+
+		if (subset == lowestBit)
 		{
-			if (outObject == nullptr || t < outIntersect)
+			int leaf = 0;
+			while (! (subset & (1 << leaf)))
 			{
-				outObject = object;
-				outIntersect = t;
+				++ leaf;
 			}
+
+			subsetBoxes[subset] = leaves[leaf]->box;
+			subsetCosts[subset] = leaves[leaf]->cost;
+			continue;
 		}
+
+		subsetBoxes[subset] = subsetBoxes[lowestBit];
+		subsetBoxes[subset].AddBox(subsetBoxes[subset ^ lowestBit]);
+
+		// Each split is only tried once, as the side holding the lowest leaf
+		float bestCost = std::numeric_limits<float>::max();
+
+		for (int part = (subset - 1) & subset; part; part = (part - 1) & subset)
+		{
+			if (! (part & lowestBit))
+				continue;
+
+			const float splitCost = subsetCosts[part] + subsetCosts[subset ^ part];
+			if (splitCost < bestCost)
+			{
+				bestCost = splitCost;
+				subsetSplits[subset] = part;
+			}
+		}
+
+		subsetCosts[subset] = subsetBoxes[subset].GetSurfaceArea() + bestCost;
 	}
 
-	return outObject != nullptr;
+	// Rounding alone must not cause the treelet to be rebuilt
+	if (subsetCosts[subsetCount - 1] >= cost * (1.f - 1e-5f))
+	{
+		return;
+	}
+
+	// Rebuild the treelet with the optimal topology, reusing its interior nodes
+	std::function<void(BoundingVolumeNode * node, const int subset)> Assign = [&](BoundingVolumeNode * node, const int subset)
+	{
+		const int parts[2] = { subsetSplits[subset], subset ^ subsetSplits[subset] };
+
+		for (int i = 0; i < 2; ++ i)
+		{
+			if ((parts[i] & (parts[i] - 1)) == 0)
+			{
+				int leaf = 0;
+				while (! (parts[i] & (1 << leaf)))
+				{
+					++ leaf;
+				}
+
+				node->children[i] = leaves[leaf];
+			}
+			else
+			{
+				node->children[i] = interior.back();
+				interior.pop_back();
+				Assign(node->children[i], parts[i]);
+			}
+		}
+
+		node->box = subsetBoxes[subset];
+		node->cost = subsetCosts[subset];
+	};
+
+	Assign(this, subsetCount - 1);
 }
 
 void BoundingVolumeNode::PrintTree(const std::string & name) const
@@ -156,3 +1041,18 @@ void BoundingVolumeNode::PrintTree(const std::string & name) const
 		children[1]->PrintTree(name + "->right");
 	}
 }
+
+const AABB & BoundingVolumeNode::GetBoundingBox() const
+{
+	return box;
+}
+
+const std::vector<BoundingVolumeNode *> & BoundingVolumeNode::GetChildren() const
+{
+	return children;
+}
+
+const std::vector<const Object *> & BoundingVolumeNode::GetObjects() const
+{
+	return objects;
+}
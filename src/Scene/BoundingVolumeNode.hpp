@@ -6,10 +6,17 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <limits>
 #include <glm/glm.hpp>
 
 #include "AABB.hpp"
 #include "Object.hpp"
+#include "PrimitivePools.hpp"
+
+#include <RayTracer/Params.hpp>
 
 
 class BoundingVolumeNode
@@ -18,21 +25,125 @@ class BoundingVolumeNode
 public:
 
 	BoundingVolumeNode() = default;
-	BoundingVolumeNode(const std::vector<const Object *> & objects);
+	~BoundingVolumeNode();
+
+	// Builds a tree over the objects. With more than one thread, large subtrees are built
+	// concurrently and the SAH bins of large nodes are filled in parallel.
+	// Leaves hold at most leafSize objects; SAH builds stop splitting sooner wherever a leaf is cheaper.
+	// Spatial split builds may reference an object from several leaves, adding at most
+	// spatialSplitBudget times the object count in extra references.
+	static BoundingVolumeNode * Build(const std::vector<const Object *> & objects, const BvhBuildMethod method, const size_t leafSize, const float spatialSplitBudget, const int threadCount);
+
+	// Length of the Morton codes used to build a linear bvh over this many objects
+	static int GetMortonCodeBits(const size_t objectCount);
 
-	static AABB ComputeBoundingBox(const std::vector<const Object *> & objects);
-	void SortObjects(const int axis);
-	void BuildTree(const int axis);
+	// Lowers the SAH cost of a built tree by giving each small treelet, bottom-up, the
+	// topology that is optimal for its leaves. Separate subtrees are restructured in parallel.
+	void RestructureTreelets(const int passCount, const int threadCount);
+
+	// Expected cost of tracing a ray through the tree under the surface area heuristic
+	float GetSAHCost() const;
 
-	bool Intersect(const Ray & ray, float & outIntersect, const Object * & outObject) const;
 	void PrintTree(const std::string & name) const;
 
+	const AABB & GetBoundingBox() const;
+	const std::vector<BoundingVolumeNode *> & GetChildren() const;
+	const std::vector<const Object *> & GetObjects() const;
+
 protected:
 
+	// Splits nodes one at a time with the same partitioning as the full builds
+	friend class LazyBoundingVolumeHierarchy;
+
+	static const int SAHBinCount = 16;
+	static const int SpatialBinCount = 32;
+
+	// Cost of visiting a node when choosing leaf sizes, in SIMD leaf tests as counted by GetLeafCost,
+	// where SpatialDataStructure::TraversalCost is in single primitive tests
+	static const float LeafTestTraversalCost;
+
+	// Spatial splits are only tried where the children of the best object split overlap
+	// by more than this fraction of the root's surface area
+	static const float SpatialSplitOverlap;
+
+	// Nodes with fewer primitives than this are always built on a single thread
+	static const size_t ParallelBuildThreshold = 4096;
+
+	// Leaves of each treelet searched for the optimal topology, which takes time exponential in this
+	static const int TreeletSize = 7;
+
+	// Larger scenes use 63-bit Morton codes, so that fewer objects share a code
+	static const size_t MortonCode30BitLimit = 1 << 16;
+
+	// Every node of a build works on its own range of one shared array, which is partitioned in place
+	struct BuildPrimitive
+	{
+		AABB box;
+		glm::vec3 center;
+		const Object * object;
+	};
+
+	// The best binned SAH partition of a range by object centroids
+	struct ObjectSplit
+	{
+		AABB box;
+		AABB centroidBox;
+
+		// -1 if every centroid coincides, so that no plane separates them
+		int axis = -1;
+		int bin = 0;
+
+		// Surface area times object count, summed over both sides
+		float cost = std::numeric_limits<float>::max();
+		size_t leftCount = 0, rightCount = 0;
+		AABB leftBox, rightBox;
+	};
+
+	// The best plane cutting through a range's box, where objects straddling it go to both sides
+	struct SpatialSplit
+	{
+		int axis = -1;
+		float position = 0;
+
+		float cost = std::numeric_limits<float>::max();
+		size_t leftCount = 0, rightCount = 0;
+		AABB leftBox, rightBox;
+	};
+
+	typedef std::function<void(BoundingVolumeNode * child, BuildPrimitive * begin, BuildPrimitive * end, const int threadCount)> BuildFunction;
+
+	static AABB ComputeBoundingBox(const BuildPrimitive * begin, const BuildPrimitive * end);
+
+	// Leaves are tested SimdWidth primitives of one pool type at a time. A leaf mixing types is
+	// flattened into a chain of single-type leaves, one SIMD test and one more node per extra type.
+	static float GetLeafCost(const size_t (& typeCounts)[PrimitivePools::TypeCount]);
+	static bool IsLeafCheaper(const BuildPrimitive * begin, const BuildPrimitive * end, const ObjectSplit & split);
+	static int GetBinIndex(const BuildPrimitive & primitive, const AABB & centroidBox, const int axis);
+	static ObjectSplit FindObjectSplit(BuildPrimitive * begin, BuildPrimitive * end, const int threadCount);
+	static BuildPrimitive * PartitionObjectSplit(BuildPrimitive * begin, BuildPrimitive * end, const ObjectSplit & split);
+	static SpatialSplit FindSpatialSplit(const BuildPrimitive * begin, const BuildPrimitive * end, const AABB & box);
+	static size_t PartitionSpatialSplit(const BuildPrimitive * begin, const BuildPrimitive * end, const SpatialSplit & split, std::vector<BuildPrimitive> & outReferences);
+	static AABB ClipReference(const BuildPrimitive & reference, const int axis, const float low, const float high);
+	static void SortByMortonCode(std::vector<BuildPrimitive> & primitives, std::vector<uint64_t> & outCodes);
+	static void ForEachChunk(BuildPrimitive * begin, BuildPrimitive * end, const int chunkCount, const std::function<void(const int chunk, BuildPrimitive * begin, BuildPrimitive * end)> & function);
+
+	void BuildMedian(BuildPrimitive * begin, BuildPrimitive * end, const int axis, const size_t leafSize, const int threadCount);
+	void BuildSAH(BuildPrimitive * begin, BuildPrimitive * end, const size_t leafSize, const int threadCount);
+	void BuildMorton(BuildPrimitive * begin, BuildPrimitive * end, const uint64_t * codes, const size_t leafSize, const int threadCount);
+	void BuildSpatialSplit(BuildPrimitive * begin, BuildPrimitive * end, const float rootArea, const size_t splitBudget, const size_t leafSize, const int threadCount);
+	void BuildChildren(BuildPrimitive * begin, BuildPrimitive * middle, BuildPrimitive * end, const int threadCount, const BuildFunction & build);
+	void MakeLeaf(const BuildPrimitive * begin, const BuildPrimitive * end);
+
+	float GetSubtreeCost() const;
+	void RestructurePass(const int threadCount);
+	void RestructureTreelet();
+
 	AABB box;
 
 	std::vector<BoundingVolumeNode *> children;
 	std::vector<const Object *> objects;
 
+	// SAH cost of the subtree without dividing by the root's area, kept up to date by RestructurePass
+	float cost = 0;
 
 };
@@ -0,0 +1,314 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "BvhCache.hpp"
+#include "FlatBoundingVolumeHierarchy.hpp"
+#include "WideBoundingVolumeHierarchy.hpp"
+#include "QuantizedBoundingVolumeHierarchy.hpp"
+
+#include <RayTracer/MappedFile.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+
+namespace
+{
+
+	const char Magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 0, 0 };
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+
+		// Guards against the node layout changing between builds of the raytracer
+		uint32_t nodeSize;
+
+		uint64_t key;
+
+		// Of the description, pool entries and nodes, since the nodes are traversed without any other checks
+		uint64_t checksum;
+
+		uint32_t nodeCount;
+		uint32_t maxDepth;
+		uint32_t descriptionLength;
+		uint32_t poolSizes[PrimitivePools::TypeCount];
+	};
+
+	// 64-bit FNV-1a
+	const uint64_t HashBasis = 0xcbf29ce484222325ull;
+
+	uint64_t Hash(uint64_t hash, const void * data, const size_t size)
+	{
+		const uint8_t * bytes = (const uint8_t *) data;
+
+		for (size_t i = 0; i < size; ++ i)
+		{
+			hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+		}
+
+		return hash;
+	}
+
+	template <typename T>
+	uint64_t HashValue(const uint64_t hash, const T & value)
+	{
+		return Hash(hash, & value, sizeof(value));
+	}
+
+	size_t AlignUp(const size_t offset, const size_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+}
+
+const uint32_t BvhCache::Version;
+const size_t BvhCache::NodeAlignment;
+
+uint64_t BvhCache::HashFile(const std::string & fileName)
+{
+	std::ifstream file(fileName, std::ios::binary);
+
+	if (! file.is_open())
+	{
+		return 0;
+	}
+
+	uint64_t hash = HashBasis;
+	char buffer[1 << 16];
+
+	while (file)
+	{
+		file.read(buffer, sizeof(buffer));
+		hash = Hash(hash, buffer, (size_t) file.gcount());
+	}
+
+	return hash;
+}
+
+uint64_t BvhCache::ComputeKey(const Params & params)
+{
+	uint64_t key = HashValue(HashBasis, params.sceneFileHash);
+	key = HashValue(key, Version);
+	key = HashValue(key, params.bvhBuildMethod);
+	key = HashValue(key, params.bvhLeafSize);
+	key = HashValue(key, params.spatialSplitBudget);
+	key = HashValue(key, params.treeletPasses);
+	key = HashValue(key, params.bvhWidth);
+	key = HashValue(key, params.quantizeBvh);
+	return key;
+}
+
+SpatialDataStructure * BvhCache::Load(const Params & params, const std::vector<const Object *> & objects, std::string & outDescription)
+{
+	if (params.quantizeBvh)
+	{
+		switch (params.bvhWidth)
+		{
+		case 4:
+			return Load<QuantizedBoundingVolumeHierarchy<4>>(params, objects, outDescription);
+
+		case 8:
+			return Load<QuantizedBoundingVolumeHierarchy<8>>(params, objects, outDescription);
+
+		default:
+			return Load<QuantizedBoundingVolumeHierarchy<2>>(params, objects, outDescription);
+		}
+	}
+
+	switch (params.bvhWidth)
+	{
+	case 4:
+		return Load<WideBoundingVolumeHierarchy<4>>(params, objects, outDescription);
+
+	case 8:
+		return Load<WideBoundingVolumeHierarchy<8>>(params, objects, outDescription);
+
+	default:
+		return Load<FlatBoundingVolumeHierarchy>(params, objects, outDescription);
+	}
+}
+
+bool BvhCache::Save(const Params & params, const SpatialDataStructure * spatialDataStructure, const std::string & description)
+{
+	if (params.quantizeBvh)
+	{
+		switch (params.bvhWidth)
+		{
+		case 4:
+			return Save(params, static_cast<const QuantizedBoundingVolumeHierarchy<4> *>(spatialDataStructure), description);
+
+		case 8:
+			return Save(params, static_cast<const QuantizedBoundingVolumeHierarchy<8> *>(spatialDataStructure), description);
+
+		default:
+			return Save(params, static_cast<const QuantizedBoundingVolumeHierarchy<2> *>(spatialDataStructure), description);
+		}
+	}
+
+	switch (params.bvhWidth)
+	{
+	case 4:
+		return Save(params, static_cast<const WideBoundingVolumeHierarchy<4> *>(spatialDataStructure), description);
+
+	case 8:
+		return Save(params, static_cast<const WideBoundingVolumeHierarchy<8> *>(spatialDataStructure), description);
+
+	default:
+		return Save(params, static_cast<const FlatBoundingVolumeHierarchy *>(spatialDataStructure), description);
+	}
+}
+
+template <typename Hierarchy>
+SpatialDataStructure * BvhCache::Load(const Params & params, const std::vector<const Object *> & objects, std::string & outDescription)
+{
+	typedef typename Hierarchy::Node Node;
+
+	MappedFile * file = new MappedFile();
+
+	if (! file->Open(params.bvhCacheFileName) || file->GetSize() < sizeof(Header))
+	{
+		delete file;
+		return nullptr;
+	}
+
+	const uint8_t * const data = file->GetData();
+
+	Header header;
+	memcpy(& header, data, sizeof(Header));
+
+	size_t poolEntryCount = 0;
+	for (int type = 0; type < PrimitivePools::TypeCount; ++ type)
+	{
+		poolEntryCount += header.poolSizes[type];
+	}
+
+	const size_t descriptionOffset = sizeof(Header);
+	const size_t poolOffset = descriptionOffset + header.descriptionLength;
+	const size_t nodeOffset = AlignUp(poolOffset + poolEntryCount * sizeof(uint32_t), NodeAlignment);
+
+	if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 ||
+		header.version != Version ||
+		header.nodeSize != sizeof(Node) ||
+		header.key != ComputeKey(params) ||
+		file->GetSize() != nodeOffset + (size_t) header.nodeCount * sizeof(Node))
+	{
+		delete file;
+		return nullptr;
+	}
+
+	uint64_t checksum = Hash(HashBasis, data + descriptionOffset, poolOffset + poolEntryCount * sizeof(uint32_t) - descriptionOffset);
+	checksum = Hash(checksum, data + nodeOffset, (size_t) header.nodeCount * sizeof(Node));
+
+	if (checksum != header.checksum)
+	{
+		delete file;
+		return nullptr;
+	}
+
+	// Objects are found by ID, which is their position in the scene file
+	std::vector<const Object *> objectsByID;
+
+	for (const Object * object : objects)
+	{
+		if (object->GetID() >= (int) objectsByID.size())
+		{
+			objectsByID.resize(object->GetID() + 1, nullptr);
+		}
+
+		objectsByID[object->GetID()] = object;
+	}
+
+	PrimitivePools pools;
+	const uint8_t * poolEntry = data + poolOffset;
+
+	for (int type = 0; type < PrimitivePools::TypeCount; ++ type)
+	{
+		for (uint32_t i = 0; i < header.poolSizes[type]; ++ i, poolEntry += sizeof(uint32_t))
+		{
+			uint32_t id;
+			memcpy(& id, poolEntry, sizeof(id));
+
+			const Object * object = id < objectsByID.size() ? objectsByID[id] : nullptr;
+
+			// The pools must be filled in exactly as they were, since the leaves index into them
+			if (! object || PrimitivePools::Classify(object) != (PrimitivePools::Type) type)
+			{
+				delete file;
+				return nullptr;
+			}
+
+			pools.Add(object);
+		}
+	}
+
+	outDescription = std::string((const char *) data + descriptionOffset, header.descriptionLength) + ", loaded from cache";
+
+	Node * const nodes = (Node *) (file->GetData() + nodeOffset);
+	return new Hierarchy(file, nodes, header.nodeCount, pools, (int) header.maxDepth);
+}
+
+template <typename Hierarchy>
+bool BvhCache::Save(const Params & params, const Hierarchy * hierarchy, const std::string & description)
+{
+	typedef typename Hierarchy::Node Node;
+
+	const PrimitivePools & pools = hierarchy->GetPools();
+	const NodeArray<Node> & nodes = hierarchy->GetNodes();
+
+	Header header;
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.nodeSize = sizeof(Node);
+	header.key = ComputeKey(params);
+	header.nodeCount = (uint32_t) nodes.size();
+	header.maxDepth = (uint32_t) hierarchy->GetMaxDepth();
+	header.descriptionLength = (uint32_t) description.size();
+
+	std::vector<uint32_t> poolEntries;
+
+	for (int type = 0; type < PrimitivePools::TypeCount; ++ type)
+	{
+		header.poolSizes[type] = pools.GetSize((PrimitivePools::Type) type);
+
+		for (uint32_t i = 0; i < header.poolSizes[type]; ++ i)
+		{
+			poolEntries.push_back((uint32_t) pools.GetObject((PrimitivePools::Type) type, i)->GetID());
+		}
+	}
+
+	header.checksum = Hash(HashBasis, description.data(), description.size());
+	header.checksum = Hash(header.checksum, poolEntries.data(), poolEntries.size() * sizeof(uint32_t));
+	header.checksum = Hash(header.checksum, nodes.begin(), nodes.size() * sizeof(Node));
+
+	const size_t poolOffset = sizeof(Header) + description.size();
+	const size_t padding = AlignUp(poolOffset + poolEntries.size() * sizeof(uint32_t), NodeAlignment) - (poolOffset + poolEntries.size() * sizeof(uint32_t));
+	const char zeros[NodeAlignment] = {};
+
+	// Write to a temporary file first, so that another run never maps a partly written cache
+	const std::string temporaryFileName = params.bvhCacheFileName + ".tmp";
+
+	{
+		std::ofstream file(temporaryFileName, std::ios::binary | std::ios::trunc);
+
+		file.write((const char *) & header, sizeof(Header));
+		file.write(description.data(), description.size());
+		file.write((const char *) poolEntries.data(), poolEntries.size() * sizeof(uint32_t));
+		file.write(zeros, padding);
+		file.write((const char *) nodes.begin(), nodes.size() * sizeof(Node));
+
+		if (! file.good())
+		{
+			file.close();
+			std::remove(temporaryFileName.c_str());
+			return false;
+		}
+	}
+
+	std::remove(params.bvhCacheFileName.c_str());
+	return std::rename(temporaryFileName.c_str(), params.bvhCacheFileName.c_str()) == 0;
+}
@@ -0,0 +1,50 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Object.hpp"
+#include "SpatialDataStructure.hpp"
+
+#include <RayTracer/Params.hpp>
+
+
+// Stores a built hierarchy in a binary file, keyed by a hash of the scene file and the
+// build options. Loading maps the file into memory and traverses its nodes in place,
+// so only the primitive pools have to be filled in again from the scene's objects.
+//
+// Objects are referred to by their ID, so a cache file is only valid for the scene
+// file it was built from, loaded the same way.
+class BvhCache
+{
+
+public:
+
+	// Returns zero if the file cannot be read
+	static uint64_t HashFile(const std::string & fileName);
+
+	// Returns nullptr if there is no cache file matching the params
+	static SpatialDataStructure * Load(const Params & params, const std::vector<const Object *> & objects, std::string & outDescription);
+	static bool Save(const Params & params, const SpatialDataStructure * spatialDataStructure, const std::string & description);
+
+protected:
+
+	static const uint32_t Version = 2;
+
+	// Nodes start on a cache line boundary within the file, which mapping keeps in memory
+	static const size_t NodeAlignment = 64;
+
+	static uint64_t ComputeKey(const Params & params);
+
+	template <typename Hierarchy>
+	static SpatialDataStructure * Load(const Params & params, const std::vector<const Object *> & objects, std::string & outDescription);
+
+	template <typename Hierarchy>
+	static bool Save(const Params & params, const Hierarchy * hierarchy, const std::string & description);
+
+};
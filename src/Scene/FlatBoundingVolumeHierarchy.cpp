@@ -0,0 +1,519 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "FlatBoundingVolumeHierarchy.hpp"
+
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+
+FlatBoundingVolumeHierarchy::FlatBoundingVolumeHierarchy(const BoundingVolumeNode * root)
+{
+	if (root->GetChildren().size() || root->GetObjects().size())
+	{
+		Flatten(root, 1);
+	}
+}
+
+FlatBoundingVolumeHierarchy::FlatBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth)
+{
+	this->nodes.Adopt(nodes, nodeCount);
+	this->pools = pools;
+	this->maxDepth = maxDepth;
+	mappedFile = file;
+}
+
+FlatBoundingVolumeHierarchy::~FlatBoundingVolumeHierarchy()
+{
+	delete mappedFile;
+}
+
+int FlatBoundingVolumeHierarchy::Flatten(const BoundingVolumeNode * node, const int depth)
+{
+	if (node->GetChildren().empty())
+	{
+		return FlattenLeaf(node->GetObjects(), node->GetBoundingBox(), depth);
+	}
+
+	const int index = (int) nodes.size();
+
+	nodes.push_back(Node());
+	nodes[index].box = node->GetBoundingBox();
+	maxDepth = glm::max(maxDepth, depth);
+
+	// BoundingVolumeNode always splits into exactly two children
+	Flatten(node->GetChildren()[0], depth + 1);
+	nodes[index].offset = (uint32_t) Flatten(node->GetChildren()[1], depth + 1);
+
+	return index;
+}
+
+int FlatBoundingVolumeHierarchy::FlattenLeaf(const std::vector<const Object *> & objects, const AABB & box, const int depth)
+{
+	const int index = (int) nodes.size();
+
+	nodes.push_back(Node());
+	nodes[index].box = box;
+	maxDepth = glm::max(maxDepth, depth);
+
+	// Split off the objects sharing the first object's type
+	const PrimitivePools::Type type = PrimitivePools::Classify(objects.front());
+
+	std::vector<const Object *> sameType, rest;
+	AABB sameTypeBox, restBox;
+
+	for (const Object * object : objects)
+	{
+		if (PrimitivePools::Classify(object) == type)
+		{
+			sameType.push_back(object);
+			sameTypeBox.AddBox(object->GetBoundingBox());
+		}
+		else
+		{
+			rest.push_back(object);
+			restBox.AddBox(object->GetBoundingBox());
+		}
+	}
+
+	if (rest.empty())
+	{
+		nodes[index].primitiveCount = (uint16_t) objects.size();
+		nodes[index].type = type;
+		nodes[index].offset = pools.GetSize(type);
+
+		for (const Object * object : objects)
+		{
+			pools.Add(object);
+		}
+	}
+	else
+	{
+		// Mixed leaves become a chain of interior nodes with one single-type leaf per type
+		FlattenLeaf(sameType, sameTypeBox, depth + 1);
+		nodes[index].offset = (uint32_t) FlattenLeaf(rest, restBox, depth + 1);
+	}
+
+	return index;
+}
+
+bool FlatBoundingVolumeHierarchy::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	const PrecomputedRay precomputed(ray);
+	HitRecord closest;
+	float entry;
+
+	if (nodes.empty() || ! nodes[0].box.Intersect(precomputed, closest.t, entry))
+	{
+		return false;
+	}
+
+	IntersectSubtree(ray, precomputed, 0, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+int FlatBoundingVolumeHierarchy::IntersectSubtree(const Ray & ray, const PrecomputedRay & precomputed, const uint32_t root, HitRecord & closest) const
+{
+	// Pathologically deep trees fall back to a heap-allocated stack
+	StackEntry localStack[StackSize];
+	std::vector<StackEntry> heapStack;
+	StackEntry * stack = localStack;
+
+	if (maxDepth > StackSize)
+	{
+		heapStack.resize(maxDepth);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	int visitedCount = 0;
+	uint32_t current = root;
+
+	while (true)
+	{
+		const Node & node = nodes[current];
+		visitedCount ++;
+
+		if (node.primitiveCount == 0)
+		{
+			// Visit the nearer child first and defer the farther one, skipping
+			// either child entirely if it starts beyond the closest hit so far
+			uint32_t near = current + 1;
+			uint32_t far = node.offset;
+			float nearEntry, farEntry;
+
+			const bool hitNear = nodes[near].box.Intersect(precomputed, closest.t, nearEntry);
+			const bool hitFar = nodes[far].box.Intersect(precomputed, closest.t, farEntry);
+
+			if (hitNear && hitFar)
+			{
+				if (farEntry < nearEntry)
+				{
+					std::swap(near, far);
+					std::swap(nearEntry, farEntry);
+				}
+
+				stack[stackSize].node = far;
+				stack[stackSize].entry = farEntry;
+				stackSize ++;
+
+				current = near;
+				continue;
+			}
+			else if (hitNear || hitFar)
+			{
+				current = hitNear ? near : far;
+				continue;
+			}
+		}
+		else
+		{
+			IntersectLeaf(node, ray, closest);
+		}
+
+		// Pop the next deferred node that could still contain a closer hit
+		do
+		{
+			if (stackSize == 0)
+			{
+				return visitedCount;
+			}
+
+			-- stackSize;
+		}
+		while (stack[stackSize].entry > closest.t);
+
+		current = stack[stackSize].node;
+	}
+}
+
+void FlatBoundingVolumeHierarchy::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+	}
+
+	// Rays only share a near/far child order if their directions have the same signs,
+	// so incoherent packets (and lone rays) are traced one at a time
+	bool coherent = count > 1;
+	const PrecomputedRay first(rays[0]);
+
+	for (int i = 1; i < count && coherent; ++ i)
+	{
+		const PrecomputedRay other(rays[i]);
+		coherent = other.sign[0] == first.sign[0] && other.sign[1] == first.sign[1] && other.sign[2] == first.sign[2];
+	}
+
+	if (! coherent || nodes.empty())
+	{
+		for (int i = 0; i < count; ++ i)
+		{
+			Intersect(rays[i], outHits[i]);
+		}
+		return;
+	}
+
+	float originX[SimdWidth], originY[SimdWidth], originZ[SimdWidth];
+	float inverseX[SimdWidth], inverseY[SimdWidth], inverseZ[SimdWidth];
+	// Each lane's closest hit distance, kept apart from outHits so it can be loaded as one SIMD register
+	float closest[SimdWidth];
+
+	for (int i = 0; i < SimdWidth; ++ i)
+	{
+		// Unused lanes repeat the first ray but can never hit anything, since their t-max is negative
+		const Ray & ray = rays[i < count ? i : 0];
+
+		originX[i] = ray.origin.x;
+		originY[i] = ray.origin.y;
+		originZ[i] = ray.origin.z;
+		inverseX[i] = 1.f / ray.direction.x;
+		inverseY[i] = 1.f / ray.direction.y;
+		inverseZ[i] = 1.f / ray.direction.z;
+		closest[i] = i < count ? std::numeric_limits<float>::max() : -1.f;
+	}
+
+	const SimdFloat packetOriginX = SimdFloat::Load(originX);
+	const SimdFloat packetOriginY = SimdFloat::Load(originY);
+	const SimdFloat packetOriginZ = SimdFloat::Load(originZ);
+	const SimdFloat packetInverseX = SimdFloat::Load(inverseX);
+	const SimdFloat packetInverseY = SimdFloat::Load(inverseY);
+	const SimdFloat packetInverseZ = SimdFloat::Load(inverseZ);
+
+	// Tests one box against every lane at once, returning one bit per lane that hits it before that lane's closest hit
+	auto IntersectBox = [&](const AABB & box)
+	{
+		static const float epsilon = 1e-6f;
+
+		const glm::vec3 nearCorner = glm::vec3(first.sign[0] ? box.max.x : box.min.x, first.sign[1] ? box.max.y : box.min.y, first.sign[2] ? box.max.z : box.min.z);
+		const glm::vec3 farCorner = glm::vec3(first.sign[0] ? box.min.x : box.max.x, first.sign[1] ? box.min.y : box.max.y, first.sign[2] ? box.min.z : box.max.z);
+
+		// Max and Min keep their second argument when the first is NaN, so a zero direction
+		// with the origin on a slab boundary leaves the interval unchanged
+		SimdFloat tmin = SimdFloat::Max((SimdFloat(nearCorner.x) - packetOriginX) * packetInverseX, SimdFloat(0.f));
+		tmin = SimdFloat::Max((SimdFloat(nearCorner.y) - packetOriginY) * packetInverseY, tmin);
+		tmin = SimdFloat::Max((SimdFloat(nearCorner.z) - packetOriginZ) * packetInverseZ, tmin);
+
+		SimdFloat tmax = SimdFloat::Min((SimdFloat(farCorner.x) - packetOriginX) * packetInverseX, SimdFloat::Load(closest));
+		tmax = SimdFloat::Min((SimdFloat(farCorner.y) - packetOriginY) * packetInverseY, tmax);
+		tmax = SimdFloat::Min((SimdFloat(farCorner.z) - packetOriginZ) * packetInverseZ, tmax);
+
+		return (tmin * SimdFloat(1.f - epsilon) <= tmax * SimdFloat(1.f + epsilon)).Bits();
+	};
+
+	uint32_t localStack[StackSize];
+	std::vector<uint32_t> heapStack;
+	uint32_t * stack = localStack;
+
+	if (maxDepth > StackSize)
+	{
+		heapStack.resize(maxDepth);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	uint32_t current = 0;
+
+	while (true)
+	{
+		const Node & node = nodes[current];
+		const int activeLanes = IntersectBox(node.box);
+
+		if (activeLanes && (activeLanes & (activeLanes - 1)) == 0)
+		{
+			// Only one ray reaches this subtree, so the packet has diverged - finish it with a single-ray traversal
+			int lane = 0;
+			while (! (activeLanes & (1 << lane)))
+			{
+				lane ++;
+			}
+
+			const PrecomputedRay precomputed(rays[lane]);
+			IntersectSubtree(rays[lane], precomputed, current, outHits[lane]);
+			closest[lane] = outHits[lane].t;
+		}
+		else if (activeLanes && node.primitiveCount == 0)
+		{
+			// Every ray has the same direction signs, so order the children along the first ray
+			uint32_t near = current + 1;
+			uint32_t far = node.offset;
+
+			if (glm::dot(nodes[far].box.GetCenter() - nodes[near].box.GetCenter(), rays[0].direction) < 0)
+			{
+				std::swap(near, far);
+			}
+
+			stack[stackSize ++] = far;
+			current = near;
+			continue;
+		}
+		else if (activeLanes)
+		{
+			for (int lane = 0; lane < count; ++ lane)
+			{
+				if (! (activeLanes & (1 << lane)))
+				{
+					continue;
+				}
+
+				IntersectLeaf(node, rays[lane], outHits[lane]);
+				closest[lane] = outHits[lane].t;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		current = stack[-- stackSize];
+	}
+}
+
+bool FlatBoundingVolumeHierarchy::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry;
+
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	uint32_t localStack[StackSize];
+	std::vector<uint32_t> heapStack;
+	uint32_t * stack = localStack;
+
+	if (maxDepth > StackSize)
+	{
+		heapStack.resize(maxDepth);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	uint32_t current = 0;
+
+	// Any hit before maxDistance will do, so there is no need to order children or track the closest hit
+	while (true)
+	{
+		const Node & node = nodes[current];
+
+		if (node.box.Intersect(precomputed, maxDistance, entry))
+		{
+			if (node.primitiveCount == 0)
+			{
+				stack[stackSize ++] = node.offset;
+				current = current + 1;
+				continue;
+			}
+
+			if (IsLeafOccluded(node, ray, maxDistance))
+			{
+				return true;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return false;
+		}
+
+		current = stack[-- stackSize];
+	}
+}
+
+void FlatBoundingVolumeHierarchy::IntersectLeaf(const Node & node, const Ray & ray, HitRecord & closest) const
+{
+	pools.Intersect(node.type, node.offset, node.primitiveCount, ray, closest);
+}
+
+bool FlatBoundingVolumeHierarchy::IsLeafOccluded(const Node & node, const Ray & ray, const float maxDistance) const
+{
+	return pools.IsOccluded(node.type, node.offset, node.primitiveCount, ray, maxDistance);
+}
+
+void FlatBoundingVolumeHierarchy::PrintTree(const std::string & name) const
+{
+	if (nodes.size())
+	{
+		PrintNode(0, name);
+	}
+}
+
+void FlatBoundingVolumeHierarchy::PrintNode(const uint32_t index, const std::string & name) const
+{
+	const Node & node = nodes[index];
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- min: " << node.box.min << std::endl;
+	std::cout << "- max: " << node.box.max << std::endl;
+	if (node.primitiveCount)
+	{
+		std::cout << "- leaf" << std::endl;
+
+		for (uint32_t i = node.offset; i < node.offset + node.primitiveCount; ++ i)
+		{
+			const Object * object = pools.GetObject(node.type, i);
+			std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+		}
+
+		std::cout << std::endl;
+	}
+	else
+	{
+		std::cout << "- branch" << std::endl;
+		std::cout << std::endl;
+
+		PrintNode(index + 1, name + "->left");
+		PrintNode(node.offset, name + "->right");
+	}
+}
+
+float FlatBoundingVolumeHierarchy::GetSAHCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.f;
+	}
+
+	const float rootArea = nodes[0].box.GetSurfaceArea();
+	float cost = 0.f;
+
+	for (const Node & node : nodes)
+	{
+		// The chance of a ray hitting a node is proportional to its surface area
+		const float probability = rootArea > 0 ? node.box.GetSurfaceArea() / rootArea : 1.f;
+		cost += probability * (node.primitiveCount ? (float) node.primitiveCount : TraversalCost);
+	}
+
+	return cost;
+}
+
+SpatialDataStructure::Statistics FlatBoundingVolumeHierarchy::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (nodes.size())
+	{
+		GatherStatistics(0, 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+	statistics.nodeBytes = nodes.size() * sizeof(Node);
+	statistics.primitiveBytes = pools.GetMemoryUsage();
+	return statistics;
+}
+
+void FlatBoundingVolumeHierarchy::GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const
+{
+	const Node & node = nodes[index];
+
+	if (node.primitiveCount)
+	{
+		statistics.AddLeaf(depth, node.primitiveCount);
+		return;
+	}
+
+	const AABB childBoxes[2] = { nodes[index + 1].box, nodes[node.offset].box };
+	statistics.AddInterior(childBoxes, 2);
+
+	GatherStatistics(index + 1, depth + 1, statistics);
+	GatherStatistics(node.offset, depth + 1, statistics);
+}
+
+int FlatBoundingVolumeHierarchy::CountVisitedNodes(const Ray & ray) const
+{
+	const PrecomputedRay precomputed(ray);
+	HitRecord closest;
+	float entry;
+
+	if (nodes.empty() || ! nodes[0].box.Intersect(precomputed, closest.t, entry))
+	{
+		return 0;
+	}
+
+	return IntersectSubtree(ray, precomputed, 0, closest);
+}
+
+const NodeArray<FlatBoundingVolumeHierarchy::Node> & FlatBoundingVolumeHierarchy::GetNodes() const
+{
+	return nodes;
+}
+
+const PrimitivePools & FlatBoundingVolumeHierarchy::GetPools() const
+{
+	return pools;
+}
+
+int FlatBoundingVolumeHierarchy::GetMaxDepth() const
+{
+	return maxDepth;
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "AABB.hpp"
+#include "Object.hpp"
+#include "BoundingVolumeNode.hpp"
+#include "PrimitivePools.hpp"
+#include "SpatialDataStructure.hpp"
+#include "NodeArray.hpp"
+
+#include <RayTracer/Simd.hpp>
+#include <RayTracer/MappedFile.hpp>
+
+
+// A BoundingVolumeNode tree compacted into one contiguous array of 32-byte nodes.
+// Nodes are stored in depth-first order, so an interior node's first child immediately
+// follows it and only the index of the second child needs to be stored.
+class FlatBoundingVolumeHierarchy : public SpatialDataStructure
+{
+
+public:
+
+	struct Node
+	{
+		AABB box;
+
+		// Interior nodes: index of the second child. Leaf nodes: index of the first primitive in the pool for the leaf's type.
+		uint32_t offset = 0;
+
+		// Zero for interior nodes
+		uint16_t primitiveCount = 0;
+
+		// Every leaf holds a single type of primitive, so it can be tested with that type's SIMD kernel
+		PrimitivePools::Type type = PrimitivePools::Type::Other;
+	};
+
+	static_assert(sizeof(Node) == 32, "FlatBoundingVolumeHierarchy::Node should fill half a cache line");
+
+	static const int MaxLeafSize = 255;
+
+	FlatBoundingVolumeHierarchy(const BoundingVolumeNode * root);
+
+	// Uses nodes that live in a mapped file, taking ownership of the file
+	FlatBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth);
+	~FlatBoundingVolumeHierarchy();
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+
+	// Tests each node against every ray of the packet at once
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+	void PrintTree(const std::string & name) const;
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	const NodeArray<Node> & GetNodes() const;
+	const PrimitivePools & GetPools() const;
+	int GetMaxDepth() const;
+
+protected:
+
+	static const int StackSize = 64;
+
+	struct StackEntry
+	{
+		uint32_t node;
+		float entry;
+	};
+
+	int Flatten(const BoundingVolumeNode * node, const int depth);
+	int FlattenLeaf(const std::vector<const Object *> & objects, const AABB & box, const int depth);
+	void IntersectLeaf(const Node & node, const Ray & ray, HitRecord & closest) const;
+	bool IsLeafOccluded(const Node & node, const Ray & ray, const float maxDistance) const;
+	// Returns the number of nodes visited
+	int IntersectSubtree(const Ray & ray, const PrecomputedRay & precomputed, const uint32_t root, HitRecord & closest) const;
+	void PrintNode(const uint32_t index, const std::string & name) const;
+	void GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const;
+
+	NodeArray<Node> nodes;
+	PrimitivePools pools;
+	int maxDepth = 0;
+	MappedFile * mappedFile = nullptr;
+
+};
@@ -0,0 +1,557 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "Grid.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+const float Grid::CellsPerObject = 2.f;
+const float Grid::MaxSubGridReferenceRatio = 4.f;
+
+Grid::Grid(const std::vector<const Object *> & objects)
+{
+	this->objects = objects;
+
+	std::vector<uint32_t> objectIndices(objects.size());
+
+	for (uint32_t i = 0; i < (uint32_t) objects.size(); ++ i)
+	{
+		objectBoxes.push_back(objects[i]->GetBoundingBox());
+		objectIndices[i] = i;
+	}
+
+	levels.push_back(Level());
+
+	for (const AABB & box : objectBoxes)
+	{
+		levels[0].bounds.AddBox(box);
+	}
+
+	SetResolution(levels[0], objectIndices.size(), MaxResolution);
+	FillCells(levels[0], objectIndices);
+
+	// Copied, since adding sub-grids moves the top level
+	const glm::ivec3 resolution = levels[0].resolution;
+	const int cellCount = resolution.x * resolution.y * resolution.z;
+	std::vector<uint32_t> subGrids(cellCount, NoSubGrid);
+
+	for (int index = 0; index < cellCount; ++ index)
+	{
+		const uint32_t first = levels[0].cellStart[index];
+		const uint32_t count = levels[0].cellStart[index + 1] - first;
+
+		if (count <= SubGridThreshold)
+		{
+			continue;
+		}
+
+		const glm::ivec3 cell = glm::ivec3(index % resolution.x, index / resolution.x % resolution.y, index / (resolution.x * resolution.y));
+		const std::vector<uint32_t> cellObjects(levels[0].cellObjects.begin() + first, levels[0].cellObjects.begin() + first + count);
+
+		Level subGrid;
+		subGrid.bounds = GetCellBox(levels[0], cell);
+		SetResolution(subGrid, count, MaxSubGridResolution);
+
+		if (! IsSubGridWorthwhile(subGrid, cellObjects))
+		{
+			continue;
+		}
+
+		FillCells(subGrid, cellObjects);
+
+		subGrids[index] = (uint32_t) levels.size();
+		levels.push_back(subGrid);
+	}
+
+	levels[0].subGrids.swap(subGrids);
+}
+
+void Grid::SetResolution(Level & level, const size_t objectCount, const int maxResolution)
+{
+	const glm::vec3 extent = level.bounds.max - level.bounds.min;
+	level.resolution = ChooseResolution(level.bounds, objectCount, maxResolution);
+
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		const bool divisible = std::isfinite(extent[axis]) && extent[axis] > 0;
+		level.cellSize[axis] = divisible ? extent[axis] / level.resolution[axis] : 0.f;
+		level.inverseCellSize[axis] = divisible ? level.resolution[axis] / extent[axis] : 0.f;
+	}
+}
+
+bool Grid::IsSubGridWorthwhile(const Level & subGrid, const std::vector<uint32_t> & objectIndices) const
+{
+	const size_t count = objectIndices.size();
+
+	if (subGrid.resolution == glm::ivec3(1))
+	{
+		return false;
+	}
+
+	// Objects covering the whole cell would be listed in every one of its sub-cells
+	size_t spanningCount = 0;
+
+	for (const uint32_t object : objectIndices)
+	{
+		const AABB & box = objectBoxes[object];
+		bool spans = true;
+
+		for (int axis = 0; axis < 3; ++ axis)
+		{
+			spans = spans && box.min[axis] <= subGrid.bounds.min[axis] && box.max[axis] >= subGrid.bounds.max[axis];
+		}
+
+		if (spans)
+		{
+			spanningCount ++;
+		}
+	}
+
+	if (spanningCount * 2 > count)
+	{
+		return false;
+	}
+
+	return CountReferences(subGrid, objectIndices) <= MaxSubGridReferenceRatio * count;
+}
+
+size_t Grid::CountReferences(const Level & level, const std::vector<uint32_t> & objectIndices) const
+{
+	size_t references = 0;
+
+	// GetCell clamps to the level, so only the part of each box inside it is counted
+	for (const uint32_t object : objectIndices)
+	{
+		const glm::ivec3 low = GetCell(level, objectBoxes[object].min);
+		const glm::ivec3 high = GetCell(level, objectBoxes[object].max);
+		references += (size_t) (high.x - low.x + 1) * (high.y - low.y + 1) * (high.z - low.z + 1);
+	}
+
+	return references;
+}
+
+void Grid::FillCells(Level & level, const std::vector<uint32_t> & objectIndices)
+{
+	const size_t cells = (size_t) level.resolution.x * level.resolution.y * level.resolution.z;
+
+	// A single cell holds everything, and the bounds may not be finite enough to find cells in
+	if (cells == 1)
+	{
+		level.cellStart = { 0, (uint32_t) objectIndices.size() };
+		level.cellObjects = objectIndices;
+		return;
+	}
+
+	// Count each cell's references, turn the counts into offsets, then fill the cells in
+	level.cellStart.assign(cells + 1, 0);
+
+	for (int pass = 0; pass < 2; ++ pass)
+	{
+		for (const uint32_t object : objectIndices)
+		{
+			const glm::ivec3 low = GetCell(level, objectBoxes[object].min);
+			const glm::ivec3 high = GetCell(level, objectBoxes[object].max);
+
+			for (int z = low.z; z <= high.z; ++ z)
+			{
+				for (int y = low.y; y <= high.y; ++ y)
+				{
+					for (int x = low.x; x <= high.x; ++ x)
+					{
+						const size_t index = x + level.resolution.x * (y + level.resolution.y * (size_t) z);
+
+						if (pass == 0)
+						{
+							level.cellStart[index + 1] ++;
+						}
+						else
+						{
+							level.cellObjects[level.cellStart[index] ++] = object;
+						}
+					}
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (size_t index = 0; index < cells; ++ index)
+			{
+				level.cellStart[index + 1] += level.cellStart[index];
+			}
+
+			level.cellObjects.resize(level.cellStart[cells]);
+		}
+		else
+		{
+			// Filling advanced every cell's start to the next cell's, so shift them back
+			for (size_t index = cells; index > 0; -- index)
+			{
+				level.cellStart[index] = level.cellStart[index - 1];
+			}
+
+			level.cellStart[0] = 0;
+		}
+	}
+}
+
+glm::ivec3 Grid::ChooseResolution(const AABB & bounds, const size_t objectCount, const int maxResolution)
+{
+	const glm::vec3 extent = bounds.max - bounds.min;
+
+	// Nothing to divide, or bounds that cannot be divided, like those of an empty box or an infinite plane
+	if (objectCount == 0 || ! std::isfinite(extent.x) || ! std::isfinite(extent.y) || ! std::isfinite(extent.z) ||
+		extent.x < 0 || extent.y < 0 || extent.z < 0)
+	{
+		return glm::ivec3(1);
+	}
+
+	const float maxExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+	const float volume = extent.x * extent.y * extent.z;
+	const float cellCount = CellsPerObject * objectCount;
+
+	// Cells are as close to cubes as the resolution allows. Flat boxes are divided as if they were as deep as they are wide.
+	const float cellsPerUnit = volume > 0 ? std::cbrt(cellCount / volume) : (maxExtent > 0 ? std::cbrt(cellCount) / maxExtent : 0.f);
+
+	glm::ivec3 resolution;
+
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		// Clamped before converting, so that very thin boxes cannot overflow the int
+		resolution[axis] = (int) std::round(glm::clamp(extent[axis] * cellsPerUnit, 1.f, (float) maxResolution));
+	}
+
+	return resolution;
+}
+
+glm::ivec3 Grid::GetCell(const Level & level, const glm::vec3 & point) const
+{
+	if (level.resolution == glm::ivec3(1))
+	{
+		return glm::ivec3(0);
+	}
+
+	const glm::ivec3 cell = glm::ivec3(glm::floor((point - level.bounds.min) * level.inverseCellSize));
+	return glm::clamp(cell, glm::ivec3(0), level.resolution - glm::ivec3(1));
+}
+
+AABB Grid::GetCellBox(const Level & level, const glm::ivec3 & cell) const
+{
+	const glm::vec3 min = level.bounds.min + glm::vec3(cell) * level.cellSize;
+
+	// The last cell along each axis ends exactly at the bounds, whatever the rounding
+	glm::vec3 max = min + level.cellSize;
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		if (cell[axis] == level.resolution[axis] - 1)
+		{
+			max[axis] = level.bounds.max[axis];
+		}
+	}
+
+	return AABB(min, max);
+}
+
+bool Grid::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord closest;
+	Traverse(ray, false, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+bool Grid::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	HitRecord closest;
+	closest.t = maxDistance;
+
+	Traverse(ray, true, closest);
+	return closest.object != nullptr;
+}
+
+int Grid::Traverse(const Ray & ray, const bool anyHit, HitRecord & closest) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry, exit;
+
+	if (objects.empty() || ! levels[0].bounds.Intersect(precomputed, closest.t, entry, exit))
+	{
+		return 0;
+	}
+
+	Mailbox mailbox;
+	std::fill(mailbox.objects, mailbox.objects + MailboxSize, NoObject);
+
+	return TraverseLevel(levels[0], ray, precomputed, entry, exit, anyHit, mailbox, closest);
+}
+
+int Grid::TraverseLevel(const Level & level, const Ray & ray, const PrecomputedRay & precomputed, const float entry, const float exit,
+	const bool anyHit, Mailbox & mailbox, HitRecord & closest) const
+{
+	glm::ivec3 cell = GetCell(level, ray.GetPoint(entry));
+	glm::ivec3 step, end;
+	glm::vec3 next, delta;
+
+	// Distances along the ray to the next cell boundary on each axis, and between boundaries
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		if (ray.direction[axis] > 0)
+		{
+			step[axis] = 1;
+			end[axis] = level.resolution[axis];
+			next[axis] = (level.bounds.min[axis] + (cell[axis] + 1) * level.cellSize[axis] - ray.origin[axis]) * precomputed.inverseDirection[axis];
+			delta[axis] = level.cellSize[axis] * precomputed.inverseDirection[axis];
+		}
+		else if (ray.direction[axis] < 0)
+		{
+			step[axis] = -1;
+			end[axis] = -1;
+			next[axis] = (level.bounds.min[axis] + cell[axis] * level.cellSize[axis] - ray.origin[axis]) * precomputed.inverseDirection[axis];
+			delta[axis] = -level.cellSize[axis] * precomputed.inverseDirection[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			end[axis] = -1;
+			next[axis] = std::numeric_limits<float>::max();
+			delta[axis] = 0;
+		}
+	}
+
+	float cellEntry = entry;
+	int visitedCount = 0;
+
+	while (true)
+	{
+		const int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+		const float cellExit = glm::min(next[axis], exit);
+		const size_t index = cell.x + level.resolution.x * (cell.y + level.resolution.y * (size_t) cell.z);
+
+		visitedCount ++;
+
+		if (level.subGrids.size() && level.subGrids[index] != NoSubGrid)
+		{
+			visitedCount += TraverseLevel(levels[level.subGrids[index]], ray, precomputed, cellEntry, cellExit, anyHit, mailbox, closest);
+		}
+		else
+		{
+			for (uint32_t i = level.cellStart[index]; i < level.cellStart[index + 1]; ++ i)
+			{
+				const uint32_t object = level.cellObjects[i];
+				uint32_t & mailboxEntry = mailbox.objects[object % MailboxSize];
+
+				if (mailboxEntry == object)
+				{
+					continue;
+				}
+
+				mailboxEntry = object;
+
+				HitRecord hit;
+				if (objects[object]->IntersectTransformed(ray, hit) && hit.t < closest.t)
+				{
+					closest = hit;
+
+					if (anyHit)
+					{
+						return visitedCount;
+					}
+				}
+			}
+		}
+
+		// Objects in later cells can only be hit further along, though a hit found here may lie in a later cell
+		if ((anyHit && closest.object) || closest.t <= cellExit || cellExit >= exit)
+		{
+			return visitedCount;
+		}
+
+		cell[axis] += step[axis];
+
+		if (cell[axis] == end[axis])
+		{
+			return visitedCount;
+		}
+
+		cellEntry = next[axis];
+		next[axis] += delta[axis];
+	}
+}
+
+void Grid::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+		Intersect(rays[i], outHits[i]);
+	}
+}
+
+void Grid::PrintTree(const std::string & name) const
+{
+	if (objects.size())
+	{
+		PrintLevel(levels[0], name);
+	}
+}
+
+void Grid::PrintLevel(const Level & level, const std::string & name) const
+{
+	std::cout << name << ":" << std::endl;
+	std::cout << "- min: " << level.bounds.min << std::endl;
+	std::cout << "- max: " << level.bounds.max << std::endl;
+	std::cout << "- cells: " << level.resolution.x << " x " << level.resolution.y << " x " << level.resolution.z << std::endl;
+	std::cout << std::endl;
+
+	// Empty cells are left out
+	for (int z = 0; z < level.resolution.z; ++ z)
+	{
+		for (int y = 0; y < level.resolution.y; ++ y)
+		{
+			for (int x = 0; x < level.resolution.x; ++ x)
+			{
+				const size_t index = x + level.resolution.x * (y + level.resolution.y * (size_t) z);
+				const std::string cellName = name + "->cell[" + std::to_string(x) + "][" + std::to_string(y) + "][" + std::to_string(z) + "]";
+
+				if (level.subGrids.size() && level.subGrids[index] != NoSubGrid)
+				{
+					PrintLevel(levels[level.subGrids[index]], cellName);
+					continue;
+				}
+
+				if (level.cellStart[index] == level.cellStart[index + 1])
+				{
+					continue;
+				}
+
+				const AABB box = GetCellBox(level, glm::ivec3(x, y, z));
+
+				std::cout << cellName << ":" << std::endl;
+				std::cout << "- min: " << box.min << std::endl;
+				std::cout << "- max: " << box.max << std::endl;
+
+				for (uint32_t i = level.cellStart[index]; i < level.cellStart[index + 1]; ++ i)
+				{
+					const Object * object = objects[level.cellObjects[i]];
+					std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+				}
+
+				std::cout << std::endl;
+			}
+		}
+	}
+}
+
+float Grid::GetSAHCost() const
+{
+	if (objects.empty())
+	{
+		return 0.f;
+	}
+
+	return GetLevelCost(levels[0], levels[0].bounds.GetSurfaceArea());
+}
+
+float Grid::GetLevelCost(const Level & level, const float rootArea) const
+{
+	float cost = 0.f;
+
+	for (int z = 0; z < level.resolution.z; ++ z)
+	{
+		for (int y = 0; y < level.resolution.y; ++ y)
+		{
+			for (int x = 0; x < level.resolution.x; ++ x)
+			{
+				const size_t index = x + level.resolution.x * (y + level.resolution.y * (size_t) z);
+
+				// The chance of a ray crossing a cell is proportional to its surface area
+				const float probability = rootArea > 0 ? GetCellBox(level, glm::ivec3(x, y, z)).GetSurfaceArea() / rootArea : 1.f;
+				cost += probability * TraversalCost;
+
+				if (level.subGrids.size() && level.subGrids[index] != NoSubGrid)
+				{
+					cost += GetLevelCost(levels[level.subGrids[index]], rootArea);
+				}
+				else
+				{
+					cost += probability * (level.cellStart[index + 1] - level.cellStart[index]);
+				}
+			}
+		}
+	}
+
+	return cost;
+}
+
+SpatialDataStructure::Statistics Grid::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (objects.size())
+	{
+		GatherStatistics(levels[0], 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+
+	for (const Level & level : levels)
+	{
+		statistics.nodeBytes += (level.cellStart.capacity() + level.cellObjects.capacity() + level.subGrids.capacity()) * sizeof(uint32_t);
+	}
+
+	statistics.primitiveBytes = objects.capacity() * sizeof(const Object *);
+	return statistics;
+}
+
+void Grid::GatherStatistics(const Level & level, const int depth, Statistics & statistics) const
+{
+	// A grid is one interior node whose children are its cells, which never overlap
+	statistics.interiorCount ++;
+
+	for (int z = 0; z < level.resolution.z; ++ z)
+	{
+		for (int y = 0; y < level.resolution.y; ++ y)
+		{
+			for (int x = 0; x < level.resolution.x; ++ x)
+			{
+				const size_t index = x + level.resolution.x * (y + level.resolution.y * (size_t) z);
+				statistics.childArea += GetCellBox(level, glm::ivec3(x, y, z)).GetSurfaceArea();
+
+				if (level.subGrids.size() && level.subGrids[index] != NoSubGrid)
+				{
+					GatherStatistics(levels[level.subGrids[index]], depth + 1, statistics);
+				}
+				else
+				{
+					statistics.AddLeaf(depth + 1, level.cellStart[index + 1] - level.cellStart[index]);
+				}
+			}
+		}
+	}
+}
+
+int Grid::CountVisitedNodes(const Ray & ray) const
+{
+	HitRecord closest;
+	return Traverse(ray, false, closest);
+}
+
+glm::ivec3 Grid::GetResolution() const
+{
+	return levels[0].resolution;
+}
+
+size_t Grid::GetSubGridCount() const
+{
+	return levels.size() - 1;
+}
@@ -0,0 +1,114 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+#include "Object.hpp"
+#include "SpatialDataStructure.hpp"
+
+
+// A two-level uniform grid. The scene's box is divided into cells, sized so that there are about
+// CellsPerObject cells per object, and each cell lists the objects whose bounding boxes overlap it.
+// Cells that still hold many objects are divided again by a grid of their own.
+// Both levels are built in time linear in the number of object references.
+//
+// Rays step from cell to cell with a 3D-DDA, in order, stopping at the first cell that contains the
+// closest hit. Objects spanning several cells are only tested once per ray, using a small mailbox.
+class Grid : public SpatialDataStructure
+{
+
+public:
+
+	Grid(const std::vector<const Object *> & objects);
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+
+	// Rays are traced one at a time
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+	void PrintTree(const std::string & name) const;
+
+	// Each cell counts like a leaf, which rays pay for every object in and for stepping through
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	glm::ivec3 GetResolution() const;
+	size_t GetSubGridCount() const;
+
+	// Cells along each axis for a top level grid over bounds holding objectCount objects
+	static glm::ivec3 ChooseResolution(const AABB & bounds, const size_t objectCount, const int maxResolution = MaxResolution);
+
+protected:
+
+	static const float CellsPerObject;
+	static const int MaxResolution = 128;
+	static const int MaxSubGridResolution = 16;
+
+	// Cells with more objects than this get a grid of their own, unless the sub-grid would list
+	// the objects more than MaxSubGridReferenceRatio times over on average
+	static const uint32_t SubGridThreshold = 16;
+	static const float MaxSubGridReferenceRatio;
+
+	static const uint32_t NoSubGrid = 0xffffffff;
+	static const uint32_t NoObject = 0xffffffff;
+
+	// Recently tested objects, by object index modulo the size. Evicting an entry only costs a repeated test.
+	static const int MailboxSize = 16;
+
+	struct Level
+	{
+		AABB bounds;
+		glm::ivec3 resolution;
+		glm::vec3 cellSize;
+		glm::vec3 inverseCellSize;
+
+		// The objects of cell c are cellObjects[cellStart[c]] up to cellObjects[cellStart[c + 1]],
+		// with cells ordered x first, then y, then z
+		std::vector<uint32_t> cellStart;
+		std::vector<uint32_t> cellObjects;
+
+		// Top level only: the level holding each cell's sub-grid, or NoSubGrid
+		std::vector<uint32_t> subGrids;
+	};
+
+	struct Mailbox
+	{
+		uint32_t objects[MailboxSize];
+	};
+
+	// Levels are built in two steps, so that a sub-grid can be judged from its resolution before its cells are filled
+	void SetResolution(Level & level, const size_t objectCount, const int maxResolution);
+	void FillCells(Level & level, const std::vector<uint32_t> & objectIndices);
+
+	// False if most objects cover the whole cell, or the sub-grid would list them too many times
+	bool IsSubGridWorthwhile(const Level & subGrid, const std::vector<uint32_t> & objectIndices) const;
+	size_t CountReferences(const Level & level, const std::vector<uint32_t> & objectIndices) const;
+
+	glm::ivec3 GetCell(const Level & level, const glm::vec3 & point) const;
+	AABB GetCellBox(const Level & level, const glm::ivec3 & cell) const;
+
+	// Steps through the level's cells between entry and exit, testing objects against closest, or
+	// stopping at the first hit before closest.t if anyHit is set. Returns the number of cells visited.
+	int TraverseLevel(const Level & level, const Ray & ray, const PrecomputedRay & precomputed, const float entry, const float exit,
+		const bool anyHit, Mailbox & mailbox, HitRecord & closest) const;
+	int Traverse(const Ray & ray, const bool anyHit, HitRecord & closest) const;
+
+	void PrintLevel(const Level & level, const std::string & name) const;
+	float GetLevelCost(const Level & level, const float rootArea) const;
+	void GatherStatistics(const Level & level, const int depth, Statistics & statistics) const;
+
+	std::vector<const Object *> objects;
+	std::vector<AABB> objectBoxes;
+
+	// The top level comes first
+	std::vector<Level> levels;
+
+};
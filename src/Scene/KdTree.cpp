@@ -0,0 +1,491 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "KdTree.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+const float KdTree::SplitIntersectionCost = 80.f;
+const float KdTree::EmptyBonus = 0.5f;
+const float KdTree::MaxDepthBase = 8.f;
+const float KdTree::MaxDepthScale = 1.3f;
+
+KdTree::KdTree(const std::vector<const Object *> & objects)
+{
+	if (objects.empty())
+	{
+		return;
+	}
+
+	this->objects = objects;
+
+	for (const Object * object : objects)
+	{
+		objectBoxes.push_back(object->GetBoundingBox());
+		bounds.AddBox(objectBoxes.back());
+	}
+
+	const uint32_t count = (uint32_t) objects.size();
+
+	// Traversal keeps one deferred cell per level on a fixed-size stack
+	depthLimit = glm::min((int) std::round(MaxDepthBase + MaxDepthScale * std::log2((float) count)), StackSize - 1);
+
+	std::vector<uint32_t> objectIndices(count);
+	for (uint32_t i = 0; i < count; ++ i)
+	{
+		objectIndices[i] = i;
+	}
+
+	// Each level writes the above side's indices past the end of its parent's, so they survive until that side is built
+	std::vector<Edge> edges[3];
+	for (int axis = 0; axis < 3; ++ axis)
+	{
+		edges[axis].resize(2 * count);
+	}
+
+	std::vector<uint32_t> below(count);
+	std::vector<uint32_t> above((depthLimit + 1) * (size_t) count);
+
+	Build(bounds, objectIndices.data(), count, 1, edges, below.data(), above.data(), 0);
+
+	// Leaves refer to the objects directly, so the indices are only needed while building
+	this->objects.clear();
+	this->objects.shrink_to_fit();
+	objectBoxes.clear();
+	objectBoxes.shrink_to_fit();
+}
+
+void KdTree::Build(const AABB & cell, const uint32_t * objectIndices, const uint32_t count, const int depth,
+	std::vector<Edge> * edges, uint32_t * below, uint32_t * above, int badRefines)
+{
+	const uint32_t nodeIndex = (uint32_t) nodes.size();
+	nodes.push_back(Node());
+	maxDepth = glm::max(maxDepth, depth);
+
+	if (count <= MaxLeafSize || depth >= depthLimit)
+	{
+		MakeLeaf(nodeIndex, objectIndices, count);
+		return;
+	}
+
+	const glm::vec3 extent = cell.max - cell.min;
+	const float inverseArea = 1.f / cell.GetSurfaceArea();
+	const float leafCost = SplitIntersectionCost * count;
+
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	uint32_t bestEdge = 0;
+
+	// Start with the longest axis, only trying the others if it has no plane inside the cell
+	int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+
+	for (int tries = 0; tries < 3 && bestAxis < 0; ++ tries, axis = (axis + 1) % 3)
+	{
+		Edge * const axisEdges = edges[axis].data();
+
+		for (uint32_t i = 0; i < count; ++ i)
+		{
+			const AABB & box = objectBoxes[objectIndices[i]];
+			axisEdges[2 * i] = { box.min[axis], objectIndices[i], true };
+			axisEdges[2 * i + 1] = { box.max[axis], objectIndices[i], false };
+		}
+
+		// Where edges coincide, starts come first so that a plane there puts the object above it
+		std::sort(axisEdges, axisEdges + 2 * count, [](const Edge & e1, const Edge & e2)
+		{
+			return e1.position == e2.position ? e1.start && ! e2.start : e1.position < e2.position;
+		});
+
+		// Sweep the candidate planes in order, counting the objects on either side of each
+		const int otherAxis1 = (axis + 1) % 3;
+		const int otherAxis2 = (axis + 2) % 3;
+		const float faceArea = extent[otherAxis1] * extent[otherAxis2];
+		const float facePerimeter = extent[otherAxis1] + extent[otherAxis2];
+
+		uint32_t belowCount = 0, aboveCount = count;
+
+		for (uint32_t i = 0; i < 2 * count; ++ i)
+		{
+			const Edge & edge = axisEdges[i];
+
+			if (! edge.start)
+			{
+				-- aboveCount;
+			}
+
+			if (edge.position > cell.min[axis] && edge.position < cell.max[axis])
+			{
+				const float belowArea = 2.f * (faceArea + (edge.position - cell.min[axis]) * facePerimeter);
+				const float aboveArea = 2.f * (faceArea + (cell.max[axis] - edge.position) * facePerimeter);
+				const float bonus = belowCount == 0 || aboveCount == 0 ? EmptyBonus : 0.f;
+				const float cost = TraversalCost + SplitIntersectionCost * (1.f - bonus) * (belowArea * inverseArea * belowCount + aboveArea * inverseArea * aboveCount);
+
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestEdge = i;
+				}
+			}
+
+			if (edge.start)
+			{
+				++ belowCount;
+			}
+		}
+	}
+
+	if (bestCost > leafCost)
+	{
+		++ badRefines;
+	}
+
+	if (bestAxis < 0 || badRefines == MaxBadRefines || (bestCost > 4.f * leafCost && count < 16))
+	{
+		MakeLeaf(nodeIndex, objectIndices, count);
+		return;
+	}
+
+	// Objects starting before the plane go below it and objects ending after it go above, so straddling objects go to both
+	const Edge * const axisEdges = edges[bestAxis].data();
+	uint32_t belowCount = 0, aboveCount = 0;
+
+	for (uint32_t i = 0; i < bestEdge; ++ i)
+	{
+		if (axisEdges[i].start)
+		{
+			below[belowCount ++] = axisEdges[i].object;
+		}
+	}
+
+	for (uint32_t i = bestEdge + 1; i < 2 * count; ++ i)
+	{
+		if (! axisEdges[i].start)
+		{
+			above[aboveCount ++] = axisEdges[i].object;
+		}
+	}
+
+	const float split = axisEdges[bestEdge].position;
+
+	AABB belowCell, aboveCell;
+	SplitCell(cell, bestAxis, split, belowCell, aboveCell);
+
+	Build(belowCell, below, belowCount, depth + 1, edges, below, above + objects.size(), badRefines);
+
+	nodes[nodeIndex].split = split;
+	nodes[nodeIndex].data = (uint32_t) nodes.size() << 2 | (uint32_t) bestAxis;
+
+	Build(aboveCell, above, aboveCount, depth + 1, edges, below, above, badRefines);
+}
+
+void KdTree::MakeLeaf(const uint32_t nodeIndex, const uint32_t * objectIndices, const uint32_t count)
+{
+	nodes[nodeIndex].offset = (uint32_t) leafObjects.size();
+	nodes[nodeIndex].data = count << 2 | LeafAxis;
+
+	for (uint32_t i = 0; i < count; ++ i)
+	{
+		leafObjects.push_back(objects[objectIndices[i]]);
+	}
+}
+
+void KdTree::SplitCell(const AABB & cell, const int axis, const float split, AABB & outBelow, AABB & outAbove)
+{
+	outBelow = outAbove = cell;
+	outBelow.max[axis] = split;
+	outAbove.min[axis] = split;
+}
+
+bool KdTree::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord closest;
+	IntersectClosest(ray, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+int KdTree::IntersectClosest(const Ray & ray, HitRecord & closest) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry, exit;
+
+	if (nodes.empty() || ! bounds.Intersect(precomputed, closest.t, entry, exit))
+	{
+		return 0;
+	}
+
+	StackEntry stack[StackSize];
+	int stackSize = 0;
+	int visitedCount = 0;
+	uint32_t current = 0;
+
+	// Cells are visited in the order the ray passes through them, so once the closest hit
+	// lies before the next cell's entry, none of the remaining cells can hold a closer one
+	while (closest.t >= entry)
+	{
+		const Node & node = nodes[current];
+		const uint32_t axis = node.data & 3;
+		visitedCount ++;
+
+		if (axis != LeafAxis)
+		{
+			const float plane = (node.split - ray.origin[axis]) * precomputed.inverseDirection[axis];
+
+			const bool belowFirst = ray.origin[axis] < node.split || (ray.origin[axis] == node.split && ray.direction[axis] <= 0);
+			const uint32_t first = belowFirst ? current + 1 : node.data >> 2;
+			const uint32_t second = belowFirst ? node.data >> 2 : current + 1;
+
+			// Only cross into the second cell if the ray reaches the plane while inside this one
+			if (plane > exit || plane <= 0)
+			{
+				current = first;
+			}
+			else if (plane < entry)
+			{
+				current = second;
+			}
+			else
+			{
+				stack[stackSize ++] = { second, plane, exit };
+				current = first;
+				exit = plane;
+			}
+
+			continue;
+		}
+
+		const uint32_t count = node.data >> 2;
+
+		for (uint32_t i = node.offset; i < node.offset + count; ++ i)
+		{
+			HitRecord hit;
+			if (leafObjects[i]->IntersectTransformed(ray, hit) && hit.t < closest.t)
+			{
+				closest = hit;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		-- stackSize;
+		current = stack[stackSize].node;
+		entry = stack[stackSize].entry;
+		exit = stack[stackSize].exit;
+	}
+
+	return visitedCount;
+}
+
+bool KdTree::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry, exit;
+
+	if (nodes.empty() || ! bounds.Intersect(precomputed, maxDistance, entry, exit))
+	{
+		return false;
+	}
+
+	StackEntry stack[StackSize];
+	int stackSize = 0;
+	uint32_t current = 0;
+
+	// Cells beyond maxDistance are never entered
+	exit = glm::min(exit, maxDistance);
+
+	while (true)
+	{
+		const Node & node = nodes[current];
+		const uint32_t axis = node.data & 3;
+
+		if (axis != LeafAxis)
+		{
+			const float plane = (node.split - ray.origin[axis]) * precomputed.inverseDirection[axis];
+
+			const bool belowFirst = ray.origin[axis] < node.split || (ray.origin[axis] == node.split && ray.direction[axis] <= 0);
+			const uint32_t first = belowFirst ? current + 1 : node.data >> 2;
+			const uint32_t second = belowFirst ? node.data >> 2 : current + 1;
+
+			if (plane > exit || plane <= 0)
+			{
+				current = first;
+			}
+			else if (plane < entry)
+			{
+				current = second;
+			}
+			else
+			{
+				stack[stackSize ++] = { second, plane, exit };
+				current = first;
+				exit = plane;
+			}
+
+			continue;
+		}
+
+		const uint32_t count = node.data >> 2;
+
+		for (uint32_t i = node.offset; i < node.offset + count; ++ i)
+		{
+			HitRecord hit;
+			if (leafObjects[i]->IntersectTransformed(ray, hit) && hit.t < maxDistance)
+			{
+				return true;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return false;
+		}
+
+		-- stackSize;
+		current = stack[stackSize].node;
+		entry = stack[stackSize].entry;
+		exit = stack[stackSize].exit;
+	}
+}
+
+void KdTree::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+		Intersect(rays[i], outHits[i]);
+	}
+}
+
+void KdTree::PrintTree(const std::string & name) const
+{
+	if (nodes.size())
+	{
+		PrintNode(0, bounds, name);
+	}
+}
+
+void KdTree::PrintNode(const uint32_t index, const AABB & cell, const std::string & name) const
+{
+	static const char axisNames[3] = { 'x', 'y', 'z' };
+
+	const Node & node = nodes[index];
+	const uint32_t axis = node.data & 3;
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- min: " << cell.min << std::endl;
+	std::cout << "- max: " << cell.max << std::endl;
+	if (axis == LeafAxis)
+	{
+		std::cout << "- leaf" << std::endl;
+
+		for (uint32_t i = node.offset; i < node.offset + (node.data >> 2); ++ i)
+		{
+			const Object * object = leafObjects[i];
+			std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+		}
+
+		std::cout << std::endl;
+	}
+	else
+	{
+		std::cout << "- split: " << axisNames[axis] << " = " << node.split << std::endl;
+		std::cout << std::endl;
+
+		AABB belowCell, aboveCell;
+		SplitCell(cell, axis, node.split, belowCell, aboveCell);
+
+		PrintNode(index + 1, belowCell, name + "->below");
+		PrintNode(node.data >> 2, aboveCell, name + "->above");
+	}
+}
+
+float KdTree::GetSAHCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.f;
+	}
+
+	return GetSubtreeCost(0, bounds, bounds.GetSurfaceArea());
+}
+
+float KdTree::GetSubtreeCost(const uint32_t index, const AABB & cell, const float rootArea) const
+{
+	const Node & node = nodes[index];
+	const uint32_t axis = node.data & 3;
+
+	// The chance of a ray entering a cell is proportional to its surface area
+	const float probability = rootArea > 0 ? cell.GetSurfaceArea() / rootArea : 1.f;
+
+	if (axis == LeafAxis)
+	{
+		return probability * (float) (node.data >> 2);
+	}
+
+	AABB belowCell, aboveCell;
+	SplitCell(cell, axis, node.split, belowCell, aboveCell);
+
+	return probability * TraversalCost + GetSubtreeCost(index + 1, belowCell, rootArea) + GetSubtreeCost(node.data >> 2, aboveCell, rootArea);
+}
+
+SpatialDataStructure::Statistics KdTree::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (nodes.size())
+	{
+		GatherStatistics(0, bounds, 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+	statistics.nodeBytes = nodes.size() * sizeof(Node);
+	statistics.primitiveBytes = leafObjects.size() * sizeof(const Object *);
+	return statistics;
+}
+
+void KdTree::GatherStatistics(const uint32_t index, const AABB & cell, const int depth, Statistics & statistics) const
+{
+	const Node & node = nodes[index];
+	const uint32_t axis = node.data & 3;
+
+	if (axis == LeafAxis)
+	{
+		statistics.AddLeaf(depth, node.data >> 2);
+		return;
+	}
+
+	AABB belowCell, aboveCell;
+	SplitCell(cell, axis, node.split, belowCell, aboveCell);
+
+	// Sibling cells only share their splitting plane, so they never overlap
+	statistics.interiorCount ++;
+	statistics.childArea += belowCell.GetSurfaceArea() + aboveCell.GetSurfaceArea();
+
+	GatherStatistics(index + 1, belowCell, depth + 1, statistics);
+	GatherStatistics(node.data >> 2, aboveCell, depth + 1, statistics);
+}
+
+int KdTree::CountVisitedNodes(const Ray & ray) const
+{
+	HitRecord closest;
+	return IntersectClosest(ray, closest);
+}
+
+int KdTree::GetMaxDepth() const
+{
+	return maxDepth;
+}
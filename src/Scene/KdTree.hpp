@@ -0,0 +1,115 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "AABB.hpp"
+#include "Object.hpp"
+#include "SpatialDataStructure.hpp"
+
+
+// Splits space rather than objects: every interior node cuts its cell in two with an
+// axis-aligned plane chosen by the surface area heuristic, and an object is listed in
+// every leaf its bounding box overlaps. Cells never overlap, so traversal visits them
+// strictly front to back and stops at the first cell that begins beyond the closest hit.
+class KdTree : public SpatialDataStructure
+{
+
+public:
+
+	struct Node
+	{
+		// Interior nodes: position of the splitting plane. Leaves: index of the first object in leafObjects.
+		union
+		{
+			float split;
+			uint32_t offset;
+		};
+
+		// The low two bits hold the split axis, or LeafAxis for a leaf. The rest hold the index of the
+		// child above the plane for interior nodes, whose child below immediately follows them,
+		// or the object count for leaves.
+		uint32_t data;
+	};
+
+	static_assert(sizeof(Node) == 8, "KdTree::Node should fit eight nodes in a cache line");
+
+	KdTree(const std::vector<const Object *> & objects);
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+
+	// Rays are traced one at a time
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+	void PrintTree(const std::string & name) const;
+
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	int GetMaxDepth() const;
+
+protected:
+
+	static const uint32_t LeafAxis = 3;
+
+	// Costs used when choosing planes, relative to traversing one node. Splits that leave
+	// one side empty get a bonus, since rays crossing the empty cell are done with it at once.
+	static const float SplitIntersectionCost;
+	static const float EmptyBonus;
+
+	// Splitting stops at this many objects, or at a depth of MaxDepthBase + MaxDepthScale * log2(object count)
+	static const uint32_t MaxLeafSize = 1;
+	static const float MaxDepthBase;
+	static const float MaxDepthScale;
+
+	// Splits worse than not splitting may be tried this many times along a path, in case they lead somewhere better
+	static const int MaxBadRefines = 3;
+
+	static const int StackSize = 64;
+
+	// Where an object's bounding box starts or ends along one axis
+	struct Edge
+	{
+		float position;
+		uint32_t object;
+		bool start;
+	};
+
+	struct StackEntry
+	{
+		uint32_t node;
+		float entry, exit;
+	};
+
+	// Appends the node for the cell and its subtree. The object indices for both children are written
+	// to below and above, which the children then reuse, and each axis's edges are sorted into edges.
+	void Build(const AABB & cell, const uint32_t * objectIndices, const uint32_t count, const int depth,
+		std::vector<Edge> * edges, uint32_t * below, uint32_t * above, int badRefines);
+	void MakeLeaf(const uint32_t nodeIndex, const uint32_t * objectIndices, const uint32_t count);
+
+	// Returns the number of nodes visited
+	int IntersectClosest(const Ray & ray, HitRecord & closest) const;
+	void PrintNode(const uint32_t index, const AABB & cell, const std::string & name) const;
+	float GetSubtreeCost(const uint32_t index, const AABB & cell, const float rootArea) const;
+	void GatherStatistics(const uint32_t index, const AABB & cell, const int depth, Statistics & statistics) const;
+
+	static void SplitCell(const AABB & cell, const int axis, const float split, AABB & outBelow, AABB & outAbove);
+
+	std::vector<Node> nodes;
+	std::vector<const Object *> leafObjects;
+
+	// Objects by index during construction
+	std::vector<const Object *> objects;
+	std::vector<AABB> objectBoxes;
+
+	AABB bounds;
+	int depthLimit = 0;
+	int maxDepth = 0;
+
+};
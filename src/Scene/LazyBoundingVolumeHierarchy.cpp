@@ -0,0 +1,430 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "LazyBoundingVolumeHierarchy.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+
+namespace
+{
+
+	// The depth of a lazily split tree is not known ahead of traversal, so the
+	// stack starts out local and moves to the heap if it ever fills up
+	template <typename T>
+	class TraversalStack
+	{
+
+	public:
+
+		void Push(const T & entry)
+		{
+			if (size == capacity)
+			{
+				if (data == local)
+				{
+					heap.assign(local, local + size);
+				}
+
+				capacity *= 2;
+				heap.resize(capacity);
+				data = heap.data();
+			}
+
+			data[size ++] = entry;
+		}
+
+		T & Pop()
+		{
+			return data[-- size];
+		}
+
+		bool Empty() const
+		{
+			return size == 0;
+		}
+
+	protected:
+
+		static const int LocalSize = 64;
+
+		T local[LocalSize];
+		std::vector<T> heap;
+		T * data = local;
+		int capacity = LocalSize;
+		int size = 0;
+
+	};
+
+}
+
+LazyBoundingVolumeHierarchy::LazyBoundingVolumeHierarchy(const std::vector<const Object *> & objects, const BvhBuildMethod method, const size_t leafSize, const int threadCount)
+{
+	this->method = method;
+	this->leafSize = leafSize;
+	this->threadCount = threadCount;
+
+	references.resize(objects.size());
+
+	for (size_t i = 0; i < objects.size(); ++ i)
+	{
+		references[i].box = objects[i]->GetBoundingBox();
+		references[i].center = references[i].box.GetCenter();
+		references[i].object = objects[i];
+	}
+
+	// Only the root's bounds are computed up front
+	root = new Node();
+	root->end = (uint32_t) references.size();
+	root->box = BoundingVolumeNode::ComputeBoundingBox(references.data(), references.data() + references.size());
+}
+
+LazyBoundingVolumeHierarchy::~LazyBoundingVolumeHierarchy()
+{
+	DeleteChildren(* root);
+	delete root;
+}
+
+void LazyBoundingVolumeHierarchy::DeleteChildren(Node & node)
+{
+	if (node.children)
+	{
+		DeleteChildren(node.children[0]);
+		DeleteChildren(node.children[1]);
+		delete [] node.children;
+	}
+}
+
+const LazyBoundingVolumeHierarchy::Node * LazyBoundingVolumeHierarchy::GetChildren(const Node & node) const
+{
+	State state = node.state.load(std::memory_order_acquire);
+
+	if (state == State::Unsplit)
+	{
+		// Queries only see a node as const, but splitting it doesn't change the tree they traverse
+		Split(const_cast<Node &>(node));
+		state = node.state.load(std::memory_order_acquire);
+	}
+
+	return state == State::Interior ? node.children : nullptr;
+}
+
+void LazyBoundingVolumeHierarchy::Split(Node & node) const
+{
+	std::lock_guard<std::mutex> lock(locks[((uintptr_t) & node / sizeof(Node)) % LockCount]);
+
+	// Another thread may have split the node while this one waited for the lock
+	if (node.state.load(std::memory_order_relaxed) != State::Unsplit)
+	{
+		return;
+	}
+
+	BuildPrimitive * const begin = references.data() + node.begin;
+	BuildPrimitive * const end = references.data() + node.end;
+
+	const size_t count = end - begin;
+
+	if (count <= (method == BvhBuildMethod::Median ? leafSize : 1))
+	{
+		node.state.store(State::Leaf, std::memory_order_release);
+		return;
+	}
+
+	BuildPrimitive * middle = nullptr;
+
+	if (method == BvhBuildMethod::Median)
+	{
+		const int axis = node.depth % 3;
+
+		std::sort(begin, end, [axis](const BuildPrimitive & p1, const BuildPrimitive & p2)
+		{
+			return p1.center[axis] < p2.center[axis];
+		});
+
+		middle = begin + (end - begin) / 2;
+	}
+	else
+	{
+		const BoundingVolumeNode::ObjectSplit split = BoundingVolumeNode::FindObjectSplit(begin, end, threadCount);
+
+		if (count <= leafSize && BoundingVolumeNode::IsLeafCheaper(begin, end, split))
+		{
+			node.state.store(State::Leaf, std::memory_order_release);
+			return;
+		}
+
+		middle = BoundingVolumeNode::PartitionObjectSplit(begin, end, split);
+	}
+
+	Node * const children = new Node[2];
+
+	children[0].begin = node.begin;
+	children[0].end = node.begin + (uint32_t) (middle - begin);
+	children[1].begin = children[0].end;
+	children[1].end = node.end;
+
+	for (int i = 0; i < 2; ++ i)
+	{
+		children[i].depth = node.depth + 1;
+		children[i].box = BoundingVolumeNode::ComputeBoundingBox(references.data() + children[i].begin, references.data() + children[i].end);
+	}
+
+	// Publishing the state last makes the children visible to other threads only once they are filled in
+	node.children = children;
+	node.state.store(State::Interior, std::memory_order_release);
+}
+
+bool LazyBoundingVolumeHierarchy::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord closest;
+	IntersectClosest(ray, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+int LazyBoundingVolumeHierarchy::IntersectClosest(const Ray & ray, HitRecord & closest) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry;
+
+	if (! root->box.Intersect(precomputed, closest.t, entry))
+	{
+		return 0;
+	}
+
+	TraversalStack<StackEntry> stack;
+	const Node * current = root;
+	int visitedCount = 0;
+
+	while (true)
+	{
+		const Node * const children = GetChildren(* current);
+		visitedCount ++;
+
+		if (children)
+		{
+			// Visit the nearer child first and defer the farther one, skipping
+			// either child entirely if it starts beyond the closest hit so far
+			const Node * near = & children[0];
+			const Node * far = & children[1];
+			float nearEntry, farEntry;
+
+			const bool hitNear = near->box.Intersect(precomputed, closest.t, nearEntry);
+			const bool hitFar = far->box.Intersect(precomputed, closest.t, farEntry);
+
+			if (hitNear && hitFar)
+			{
+				if (farEntry < nearEntry)
+				{
+					std::swap(near, far);
+					std::swap(nearEntry, farEntry);
+				}
+
+				stack.Push({ far, farEntry });
+
+				current = near;
+				continue;
+			}
+			else if (hitNear || hitFar)
+			{
+				current = hitNear ? near : far;
+				continue;
+			}
+		}
+		else
+		{
+			IntersectLeaf(* current, ray, closest);
+		}
+
+		// Pop the next deferred node that could still contain a closer hit
+		current = nullptr;
+
+		while (! stack.Empty())
+		{
+			const StackEntry & next = stack.Pop();
+
+			if (next.entry <= closest.t)
+			{
+				current = next.node;
+				break;
+			}
+		}
+
+		if (! current)
+		{
+			return visitedCount;
+		}
+	}
+}
+
+bool LazyBoundingVolumeHierarchy::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	const PrecomputedRay precomputed(ray);
+	float entry;
+
+	TraversalStack<const Node *> stack;
+	const Node * current = root;
+
+	// Any hit before maxDistance will do, so there is no need to order children or track the closest hit
+	while (true)
+	{
+		if (current->box.Intersect(precomputed, maxDistance, entry))
+		{
+			const Node * const children = GetChildren(* current);
+
+			if (children)
+			{
+				stack.Push(& children[1]);
+				current = & children[0];
+				continue;
+			}
+
+			if (IsLeafOccluded(* current, ray, maxDistance))
+			{
+				return true;
+			}
+		}
+
+		if (stack.Empty())
+		{
+			return false;
+		}
+
+		current = stack.Pop();
+	}
+}
+
+void LazyBoundingVolumeHierarchy::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+		Intersect(rays[i], outHits[i]);
+	}
+}
+
+void LazyBoundingVolumeHierarchy::IntersectLeaf(const Node & node, const Ray & ray, HitRecord & closest) const
+{
+	for (uint32_t i = node.begin; i < node.end; ++ i)
+	{
+		HitRecord hit;
+		if (references[i].object->IntersectTransformed(ray, hit) && hit.t < closest.t)
+		{
+			closest = hit;
+		}
+	}
+}
+
+bool LazyBoundingVolumeHierarchy::IsLeafOccluded(const Node & node, const Ray & ray, const float maxDistance) const
+{
+	for (uint32_t i = node.begin; i < node.end; ++ i)
+	{
+		HitRecord hit;
+		if (references[i].object->IntersectTransformed(ray, hit) && hit.t < maxDistance)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void LazyBoundingVolumeHierarchy::PrintTree(const std::string & name) const
+{
+	if (root->end > root->begin)
+	{
+		PrintNode(* root, name);
+	}
+}
+
+void LazyBoundingVolumeHierarchy::PrintNode(const Node & node, const std::string & name) const
+{
+	const Node * const children = GetChildren(node);
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- min: " << node.box.min << std::endl;
+	std::cout << "- max: " << node.box.max << std::endl;
+	if (! children)
+	{
+		std::cout << "- leaf" << std::endl;
+
+		for (uint32_t i = node.begin; i < node.end; ++ i)
+		{
+			const Object * object = references[i].object;
+			std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+		}
+
+		std::cout << std::endl;
+	}
+	else
+	{
+		std::cout << "- branch" << std::endl;
+		std::cout << std::endl;
+
+		PrintNode(children[0], name + "->left");
+		PrintNode(children[1], name + "->right");
+	}
+}
+
+float LazyBoundingVolumeHierarchy::GetSAHCost() const
+{
+	const float rootArea = root->box.GetSurfaceArea();
+	return GetSubtreeCost(* root, rootArea);
+}
+
+float LazyBoundingVolumeHierarchy::GetSubtreeCost(const Node & node, const float rootArea) const
+{
+	// The chance of a ray hitting a node is proportional to its surface area
+	const float probability = rootArea > 0 ? node.box.GetSurfaceArea() / rootArea : 1.f;
+
+	if (node.state.load(std::memory_order_acquire) != State::Interior)
+	{
+		return probability * (float) (node.end - node.begin);
+	}
+
+	return probability * TraversalCost + GetSubtreeCost(node.children[0], rootArea) + GetSubtreeCost(node.children[1], rootArea);
+}
+
+SpatialDataStructure::Statistics LazyBoundingVolumeHierarchy::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (root->end > root->begin)
+	{
+		GatherStatistics(* root, 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+	statistics.nodeBytes = (statistics.interiorCount * 2 + 1) * sizeof(Node);
+	statistics.primitiveBytes = references.capacity() * sizeof(BuildPrimitive);
+	return statistics;
+}
+
+void LazyBoundingVolumeHierarchy::GatherStatistics(const Node & node, const int depth, Statistics & statistics) const
+{
+	// Only the nodes split so far are counted, leaving the rest as leaves
+	if (node.state.load(std::memory_order_acquire) != State::Interior)
+	{
+		statistics.AddLeaf(depth, node.end - node.begin);
+		return;
+	}
+
+	const AABB childBoxes[2] = { node.children[0].box, node.children[1].box };
+	statistics.AddInterior(childBoxes, 2);
+
+	GatherStatistics(node.children[0], depth + 1, statistics);
+	GatherStatistics(node.children[1], depth + 1, statistics);
+}
+
+int LazyBoundingVolumeHierarchy::CountVisitedNodes(const Ray & ray) const
+{
+	HitRecord closest;
+	return IntersectClosest(ray, closest);
+}
@@ -0,0 +1,116 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+#include "AABB.hpp"
+#include "Object.hpp"
+#include "BoundingVolumeNode.hpp"
+#include "SpatialDataStructure.hpp"
+
+#include <RayTracer/Params.hpp>
+
+
+// A binary hierarchy whose nodes are only split the first time a ray reaches them,
+// so that building costs nothing for the parts of the scene no ray ever visits.
+// Nodes are split with the same median or SAH partitioning as BoundingVolumeNode, so once every
+// node has been visited the objects are partitioned the same way. Leaves mixing primitive types are
+// kept whole rather than split into a chain per type as FlatBoundingVolumeHierarchy does, so the
+// printed trees differ for such scenes.
+//
+// Queries may run concurrently: a node is split by whichever thread reaches it first
+// while holding a lock, and other threads only see its children once they are complete.
+class LazyBoundingVolumeHierarchy : public SpatialDataStructure
+{
+
+public:
+
+	LazyBoundingVolumeHierarchy(const std::vector<const Object *> & objects, const BvhBuildMethod method, const size_t leafSize, const int threadCount);
+	~LazyBoundingVolumeHierarchy();
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+
+	// Rays are traced one at a time
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+
+	// Splits every node that has not been split yet
+	void PrintTree(const std::string & name) const;
+
+	// Nodes that have not been split yet count as leaves
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	// non-copyable
+	LazyBoundingVolumeHierarchy(const LazyBoundingVolumeHierarchy &) = delete;
+	LazyBoundingVolumeHierarchy & operator = (const LazyBoundingVolumeHierarchy &) = delete;
+
+protected:
+
+	typedef BoundingVolumeNode::BuildPrimitive BuildPrimitive;
+
+	// Nodes being split are locked by address, sharing a fixed set of locks
+	static const int LockCount = 64;
+
+	enum class State : uint8_t
+	{
+		Unsplit,
+		Leaf,
+		Interior
+	};
+
+	struct Node
+	{
+		AABB box;
+
+		// The node's range of references, which splitting the node partitions in place
+		uint32_t begin = 0;
+		uint32_t end = 0;
+
+		// Median splits cycle through the axes by depth
+		uint32_t depth = 0;
+
+		// Both children are allocated together, and only once the node is split
+		Node * children = nullptr;
+
+		std::atomic<State> state { State::Unsplit };
+	};
+
+	struct StackEntry
+	{
+		const Node * node;
+		float entry;
+	};
+
+	// Returns the node's children, splitting it first if no thread has yet, or nullptr for a leaf
+	const Node * GetChildren(const Node & node) const;
+	void Split(Node & node) const;
+
+	// Returns the number of nodes visited
+	int IntersectClosest(const Ray & ray, HitRecord & closest) const;
+	void IntersectLeaf(const Node & node, const Ray & ray, HitRecord & closest) const;
+	bool IsLeafOccluded(const Node & node, const Ray & ray, const float maxDistance) const;
+	void PrintNode(const Node & node, const std::string & name) const;
+	float GetSubtreeCost(const Node & node, const float rootArea) const;
+	void GatherStatistics(const Node & node, const int depth, Statistics & statistics) const;
+	void DeleteChildren(Node & node);
+
+	BvhBuildMethod method;
+	size_t leafSize;
+	int threadCount;
+
+	// Node ranges index into this, and only the thread splitting a node touches its range
+	mutable std::vector<BuildPrimitive> references;
+	mutable std::mutex locks[LockCount];
+
+	Node * root = nullptr;
+
+};
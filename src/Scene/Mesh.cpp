@@ -0,0 +1,33 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "Mesh.hpp"
+
+
+void Mesh::AddObject(const Object * object)
+{
+	objects.push_back(object);
+	boundingBox.AddBox(object->GetBoundingBox());
+}
+
+const std::vector<const Object *> & Mesh::GetObjects() const
+{
+	return objects;
+}
+
+const AABB & Mesh::GetBoundingBox() const
+{
+	return boundingBox;
+}
+
+void Mesh::SetSpatialDataStructure(SpatialDataStructure * spatialDataStructure)
+{
+	delete this->spatialDataStructure;
+	this->spatialDataStructure = spatialDataStructure;
+}
+
+const SpatialDataStructure * Mesh::GetSpatialDataStructure() const
+{
+	return spatialDataStructure;
+}
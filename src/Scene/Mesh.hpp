@@ -0,0 +1,42 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <vector>
+
+#include "Object.hpp"
+#include "AABB.hpp"
+#include "SpatialDataStructure.hpp"
+
+
+// Geometry shared by every instance that places it in the scene.
+// Its objects get their own spatial data structure, built once in the mesh's
+// object space and traversed by each instance with the ray in that space.
+class Mesh
+{
+
+	// non-copyable
+	Mesh(const Mesh &) = delete;
+	Mesh & operator =(const Mesh &) = delete;
+
+public:
+
+	Mesh() = default;
+
+	void AddObject(const Object * object);
+	const std::vector<const Object *> & GetObjects() const;
+	const AABB & GetBoundingBox() const;
+
+	// Takes ownership of the structure, deleting any previous one
+	void SetSpatialDataStructure(SpatialDataStructure * spatialDataStructure);
+	const SpatialDataStructure * GetSpatialDataStructure() const;
+
+protected:
+
+	std::vector<const Object *> objects;
+	AABB boundingBox;
+	SpatialDataStructure * spatialDataStructure = nullptr;
+
+};
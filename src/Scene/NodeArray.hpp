@@ -0,0 +1,58 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+
+// Node storage for the flattened hierarchies. Nodes are either appended to an array
+// owned by the hierarchy while it is built, or adopted from memory owned elsewhere,
+// such as a mapped cache file, so that they never have to be copied.
+template <typename T>
+class NodeArray
+{
+
+	// non-copyable
+	NodeArray(const NodeArray &) = delete;
+	NodeArray & operator =(const NodeArray &) = delete;
+
+public:
+
+	NodeArray() = default;
+
+	void push_back(const T & node)
+	{
+		storage.push_back(node);
+		nodes = storage.data();
+		count = storage.size();
+	}
+
+	// The nodes must outlive this array
+	void Adopt(T * const nodes, const size_t count)
+	{
+		storage.clear();
+		this->nodes = nodes;
+		this->count = count;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T & operator [](const size_t index) { return nodes[index]; }
+	const T & operator [](const size_t index) const { return nodes[index]; }
+
+	T * begin() { return nodes; }
+	T * end() { return nodes + count; }
+	const T * begin() const { return nodes; }
+	const T * end() const { return nodes + count; }
+
+protected:
+
+	std::vector<T> storage;
+	T * nodes = nullptr;
+	size_t count = 0;
+
+};
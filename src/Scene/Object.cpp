@@ -6,6 +6,16 @@
 #include "Object.hpp"
 
 
+Object::Object(ObjectType const type)
+{
+	this->type = type;
+}
+
+ObjectType Object::GetType() const
+{
+	return type;
+}
+
 void Object::SetID(int const id)
 {
 	this->id = id;
@@ -31,17 +41,40 @@ void Object::SetModelMatrix(glm::mat4 const & modelMatrix)
 	this->modelMatrix = modelMatrix;
 	inverseModelMatrix = glm::inverse(modelMatrix);
 	normalMatrix = glm::transpose(inverseModelMatrix);
+	transformed = modelMatrix != glm::mat4(1.f);
 }
 
-float Object::IntersectTransformed(Ray const & ray) const
+glm::mat4 const & Object::GetModelMatrix() const
 {
-	return Intersect(ray * inverseModelMatrix);
+	return modelMatrix;
 }
 
-glm::vec3 Object::CalculateNormalTransformed(glm::vec3 const & intersectionPoint) const
+bool Object::IsTransformed() const
 {
+	return transformed;
+}
+
+bool Object::IntersectTransformed(Ray const & ray, HitRecord & outHit) const
+{
+	outHit.object = this;
+
+	if (! transformed)
+	{
+		return Intersect(ray, outHit);
+	}
+
+	return Intersect(ray * inverseModelMatrix, outHit);
+}
+
+glm::vec3 Object::CalculateNormalTransformed(HitRecord const & hit, glm::vec3 const & intersectionPoint) const
+{
+	if (! transformed)
+	{
+		return glm::normalize(CalculateNormal(hit, intersectionPoint));
+	}
+
 	const glm::vec3 objectSpaceIntersection = glm::vec3(inverseModelMatrix * glm::vec4(intersectionPoint, 1.f));
-	const glm::vec3 objectSpaceNormal = CalculateNormal(objectSpaceIntersection);
+	const glm::vec3 objectSpaceNormal = CalculateNormal(hit, objectSpaceIntersection);
 
 	return glm::normalize(glm::vec3(normalMatrix * glm::vec4(objectSpaceNormal, 0.f)));
 }
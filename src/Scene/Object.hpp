@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <glm/glm.hpp>
 #include <parser/Objects.hpp>
 #include <RayTracer/Ray.hpp>
@@ -12,6 +14,33 @@
 #include "AABB.hpp"
 
 
+enum class ObjectType : uint8_t
+{
+	Sphere,
+	Plane,
+	Triangle,
+	Box,
+	Instance
+};
+
+class Object;
+
+// Everything an intersection test learns about a hit, so that only the closest hit needs to be shaded
+struct HitRecord
+{
+	float t = std::numeric_limits<float>::max();
+	const Object * object = nullptr;
+
+	// Box hits: which face was hit, as axis * 2, plus one for the face at the maximum
+	int face = -1;
+
+	// Triangle hits: weights of the second and third vertex
+	glm::vec2 barycentrics;
+
+	// Instance hits: the object hit inside the instanced mesh, which the other fields describe
+	const Object * primitive = nullptr;
+};
+
 struct Material
 {
 	parser::Finish finish;
@@ -24,7 +53,9 @@ class Object
 
 public:
 
-	Object() = default;
+	Object(ObjectType const type);
+
+	ObjectType GetType() const;
 
 	void SetID(int const id);
 	int GetID() const;
@@ -33,15 +64,22 @@ public:
 	Material const & GetMaterial() const;
 
 	void SetModelMatrix(glm::mat4 const & modelMatrix);
-	float IntersectTransformed(Ray const & ray) const;
-	glm::vec3 CalculateNormalTransformed(glm::vec3 const & intersectionPoint) const;
+	glm::mat4 const & GetModelMatrix() const;
+	bool IsTransformed() const;
+	bool IntersectTransformed(Ray const & ray, HitRecord & outHit) const;
+	glm::vec3 CalculateNormalTransformed(HitRecord const & hit, glm::vec3 const & intersectionPoint) const;
 
 	const AABB & GetBoundingBox() const;
 	void StoreBoundingBox();
 
-	virtual float Intersect(Ray const & ray) const = 0;
-	virtual glm::vec3 CalculateNormal(glm::vec3 const & intersectionPoint) const = 0;
+	// Fills in the hit's t and any shape-specific details, returning false on a miss
+	virtual bool Intersect(Ray const & ray, HitRecord & outHit) const = 0;
+	virtual glm::vec3 CalculateNormal(HitRecord const & hit, glm::vec3 const & intersectionPoint) const = 0;
 	virtual AABB ComputeBoundingBox() const = 0;
+
+	// Applies the transform directly to the object's geometry if the result is still
+	// the same kind of shape, and returns false if a model matrix is needed instead
+	virtual bool BakeTransform(glm::mat4 const & transform) = 0;
 	virtual std::string GetObjectType() const = 0;
 
 protected:
@@ -50,7 +88,9 @@ protected:
 	glm::mat4 modelMatrix;
 	glm::mat4 inverseModelMatrix;
 	glm::mat4 normalMatrix;
+	bool transformed = false;
 	int id = -1;
+	ObjectType type;
 	AABB boundingBox;
 
 };
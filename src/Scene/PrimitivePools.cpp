@@ -0,0 +1,225 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "PrimitivePools.hpp"
+
+#include <Objects/Triangle.hpp>
+#include <Objects/Sphere.hpp>
+#include <Objects/Box.hpp>
+#include <Objects/Plane.hpp>
+
+#include <RayTracer/Simd.hpp>
+
+
+namespace
+{
+
+	// Finds the closest primitive of a batch in [first, first + count) hit in [0, closest.t), one SIMD group at a time
+	template <typename Batch>
+	int IntersectBatch(const Batch & batch, const uint32_t first, const uint32_t count, const Ray & ray, HitRecord & closest)
+	{
+		int closestIndex = -1;
+
+		for (uint32_t index = first; index < first + count; index += SimdWidth)
+		{
+			HitRecord hits[SimdWidth];
+			const int hitMask = batch.IntersectMask(ray, index, first + count - index, closest.t, hits);
+
+			for (int lane = 0; hitMask >> lane; ++ lane)
+			{
+				if ((hitMask & (1 << lane)) && hits[lane].t < closest.t)
+				{
+					closest = hits[lane];
+					closestIndex = (int) index + lane;
+				}
+			}
+		}
+
+		return closestIndex;
+	}
+
+	template <typename Batch>
+	bool IsBatchOccluded(const Batch & batch, const uint32_t first, const uint32_t count, const Ray & ray, const float maxDistance)
+	{
+		for (uint32_t index = first; index < first + count; index += SimdWidth)
+		{
+			if (batch.IntersectMask(ray, index, first + count - index, maxDistance, nullptr))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+}
+
+PrimitivePools::Type PrimitivePools::Classify(const Object * object)
+{
+	// Triangles stay triangles under any affine transform, and a ray hits the transformed
+	// triangle at the same t as it hits the original in object space
+	if (object->GetType() == ObjectType::Triangle)
+	{
+		return Type::Triangle;
+	}
+
+	if (object->IsTransformed())
+	{
+		return Type::Other;
+	}
+
+	switch (object->GetType())
+	{
+	case ObjectType::Sphere:
+		return Type::Sphere;
+	case ObjectType::Box:
+		return Type::Box;
+	case ObjectType::Plane:
+		return Type::Plane;
+	default:
+		return Type::Other;
+	}
+}
+
+uint32_t PrimitivePools::Add(const Object * object)
+{
+	const Type type = Classify(object);
+
+	switch (type)
+	{
+	case Type::Triangle:
+	{
+		const Triangle * triangle = static_cast<const Triangle *>(object);
+		const glm::mat4 & modelMatrix = triangle->GetModelMatrix();
+
+		triangles.Add(
+			glm::vec3(modelMatrix * glm::vec4(triangle->GetVertex(0), 1.f)),
+			glm::vec3(modelMatrix * glm::vec4(triangle->GetVertex(1), 1.f)),
+			glm::vec3(modelMatrix * glm::vec4(triangle->GetVertex(2), 1.f)));
+		break;
+	}
+
+	case Type::Sphere:
+	{
+		const Sphere * sphere = static_cast<const Sphere *>(object);
+		spheres.Add(sphere->GetCenter(), sphere->GetRadius());
+		break;
+	}
+
+	case Type::Box:
+	{
+		const Box * box = static_cast<const Box *>(object);
+		boxes.Add(box->GetBox().min, box->GetBox().max);
+		break;
+	}
+
+	case Type::Plane:
+	{
+		const Plane * plane = static_cast<const Plane *>(object);
+		planes.Add(plane->GetNormal(), plane->GetDistance());
+		break;
+	}
+
+	case Type::Other:
+		break;
+	}
+
+	std::vector<const Object *> & pool = objects[(int) type];
+	pool.push_back(object);
+	return (uint32_t) pool.size() - 1;
+}
+
+uint32_t PrimitivePools::GetSize(const Type type) const
+{
+	return (uint32_t) objects[(int) type].size();
+}
+
+const Object * PrimitivePools::GetObject(const Type type, const uint32_t index) const
+{
+	return objects[(int) type][index];
+}
+
+size_t PrimitivePools::GetMemoryUsage() const
+{
+	size_t bytes = triangles.GetMemoryUsage() + spheres.GetMemoryUsage() + boxes.GetMemoryUsage() + planes.GetMemoryUsage();
+
+	for (int type = 0; type < TypeCount; ++ type)
+	{
+		bytes += objects[type].capacity() * sizeof(const Object *);
+	}
+
+	return bytes;
+}
+
+void PrimitivePools::Intersect(const Type type, const uint32_t first, const uint32_t count, const Ray & ray, HitRecord & closest) const
+{
+	int index = -1;
+
+	switch (type)
+	{
+	case Type::Triangle:
+		index = IntersectBatch(triangles, first, count, ray, closest);
+		break;
+
+	case Type::Sphere:
+		index = IntersectBatch(spheres, first, count, ray, closest);
+		break;
+
+	case Type::Box:
+		index = IntersectBatch(boxes, first, count, ray, closest);
+		break;
+
+	case Type::Plane:
+		index = IntersectBatch(planes, first, count, ray, closest);
+		break;
+
+	case Type::Other:
+		for (uint32_t i = first; i < first + count; ++ i)
+		{
+			HitRecord hit;
+			if (objects[(int) type][i]->IntersectTransformed(ray, hit) && hit.t < closest.t)
+			{
+				closest = hit;
+				index = (int) i;
+			}
+		}
+		break;
+	}
+
+	if (index >= 0)
+	{
+		closest.object = objects[(int) type][index];
+	}
+}
+
+bool PrimitivePools::IsOccluded(const Type type, const uint32_t first, const uint32_t count, const Ray & ray, const float maxDistance) const
+{
+	switch (type)
+	{
+	case Type::Triangle:
+		return IsBatchOccluded(triangles, first, count, ray, maxDistance);
+
+	case Type::Sphere:
+		return IsBatchOccluded(spheres, first, count, ray, maxDistance);
+
+	case Type::Box:
+		return IsBatchOccluded(boxes, first, count, ray, maxDistance);
+
+	case Type::Plane:
+		return IsBatchOccluded(planes, first, count, ray, maxDistance);
+
+	case Type::Other:
+		for (uint32_t i = first; i < first + count; ++ i)
+		{
+			HitRecord hit;
+			if (objects[(int) type][i]->IntersectTransformed(ray, hit) && hit.t < maxDistance)
+			{
+				return true;
+			}
+		}
+		break;
+	}
+
+	return false;
+}
@@ -0,0 +1,64 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Object.hpp"
+
+#include <Objects/TriangleBatch.hpp>
+#include <Objects/SphereBatch.hpp>
+#include <Objects/BoxBatch.hpp>
+#include <Objects/PlaneBatch.hpp>
+
+
+// Scene geometry segregated by type into contiguous structure-of-arrays pools.
+// Only the geometry needed for hit testing lives in the pools; the Object behind
+// each primitive (material, normals, ID) is kept separately and only looked up for hits.
+class PrimitivePools
+{
+
+public:
+
+	enum class Type : uint8_t
+	{
+		Triangle,
+		Sphere,
+		Box,
+		Plane,
+
+		// Anything the pools cannot represent in world space, tested through Object::IntersectTransformed
+		Other
+	};
+
+	static const int TypeCount = 5;
+
+	static Type Classify(const Object * object);
+
+	// Appends the object to the pool for its type and returns its index within that pool.
+	// Objects added consecutively with the same type occupy a contiguous range.
+	uint32_t Add(const Object * object);
+
+	uint32_t GetSize(const Type type) const;
+	const Object * GetObject(const Type type, const uint32_t index) const;
+
+	// Bytes allocated for the pools, counting each object pointer but not the object behind it
+	size_t GetMemoryUsage() const;
+
+	// Replaces closest with the closest hit in the range if it is nearer than closest.t
+	void Intersect(const Type type, const uint32_t first, const uint32_t count, const Ray & ray, HitRecord & closest) const;
+	bool IsOccluded(const Type type, const uint32_t first, const uint32_t count, const Ray & ray, const float maxDistance) const;
+
+protected:
+
+	TriangleBatch triangles;
+	SphereBatch spheres;
+	BoxBatch boxes;
+	PlaneBatch planes;
+
+	std::vector<const Object *> objects[TypeCount];
+
+};
@@ -0,0 +1,560 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "QuantizedBoundingVolumeHierarchy.hpp"
+
+#include <iostream>
+#include <limits>
+#include <cmath>
+#include <cstring>
+
+
+template <int Width>
+QuantizedBoundingVolumeHierarchy<Width>::QuantizedBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy & binary)
+{
+	// Leaves keep referring to the same primitive ranges, so the pools are shared as-is
+	pools = binary.GetPools();
+
+	if (binary.GetNodes().size())
+	{
+		Collapse(binary.GetNodes(), 0, 1);
+	}
+}
+
+template <int Width>
+QuantizedBoundingVolumeHierarchy<Width>::QuantizedBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth)
+{
+	this->nodes.Adopt(nodes, nodeCount);
+	this->pools = pools;
+	this->maxDepth = maxDepth;
+	mappedFile = file;
+}
+
+template <int Width>
+QuantizedBoundingVolumeHierarchy<Width>::~QuantizedBoundingVolumeHierarchy()
+{
+	delete mappedFile;
+}
+
+template <int Width>
+uint32_t QuantizedBoundingVolumeHierarchy<Width>::Collapse(const NodeArray<FlatBoundingVolumeHierarchy::Node> & binaryNodes, const uint32_t binaryIndex, const int depth)
+{
+	std::vector<uint32_t> children;
+
+	if (binaryNodes[binaryIndex].primitiveCount)
+	{
+		children.push_back(binaryIndex);
+	}
+	else
+	{
+		children.push_back(binaryIndex + 1);
+		children.push_back(binaryNodes[binaryIndex].offset);
+	}
+
+	// Pull grandchildren up by repeatedly opening the interior child with the largest surface area
+	while ((int) children.size() < Width)
+	{
+		int largest = -1;
+		float largestArea = -1.f;
+
+		for (int i = 0; i < (int) children.size(); ++ i)
+		{
+			const FlatBoundingVolumeHierarchy::Node & child = binaryNodes[children[i]];
+
+			if (child.primitiveCount == 0 && child.box.GetSurfaceArea() > largestArea)
+			{
+				largest = i;
+				largestArea = child.box.GetSurfaceArea();
+			}
+		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		const uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children.push_back(binaryNodes[opened].offset);
+	}
+
+	const uint32_t index = (uint32_t) nodes.size();
+
+	nodes.push_back(Node());
+	maxDepth = glm::max(maxDepth, depth);
+
+	Node & node = nodes[index];
+	node.childCount = (uint8_t) children.size();
+
+	AABB childBoxes[Width];
+
+	for (int slot = 0; slot < (int) children.size(); ++ slot)
+	{
+		const FlatBoundingVolumeHierarchy::Node & child = binaryNodes[children[slot]];
+
+		childBoxes[slot] = child.box;
+		node.offset[slot] = child.offset;
+		node.primitiveCount[slot] = (uint8_t) child.primitiveCount;
+		node.type[slot] = child.type;
+	}
+
+	Quantize(node, childBoxes);
+
+	// Collapsing the children grows the node array, so the reference above cannot be used past this point
+	for (int slot = 0; slot < (int) children.size(); ++ slot)
+	{
+		if (binaryNodes[children[slot]].primitiveCount == 0)
+		{
+			const uint32_t childIndex = Collapse(binaryNodes, children[slot], depth + 1);
+			nodes[index].offset[slot] = childIndex;
+		}
+	}
+
+	return index;
+}
+
+template <int Width>
+void QuantizedBoundingVolumeHierarchy<Width>::Quantize(Node & node, const AABB * childBoxes)
+{
+	AABB box;
+	for (int slot = 0; slot < node.childCount; ++ slot)
+	{
+		box.AddBox(childBoxes[slot]);
+	}
+
+	for (int i = 0; i < 3; ++ i)
+	{
+		// The smallest power of two step that spans the box in 255 steps
+		const double extent = (double) box.max[i] - box.min[i];
+		int exponent = extent > 0 ? (int) std::ceil(std::log2(extent / 255)) : MinExponent;
+
+		while (exponent < MaxExponent && std::ldexp(255.0, exponent) < extent)
+		{
+			++ exponent;
+		}
+
+		exponent = glm::clamp(exponent, MinExponent, MaxExponent);
+
+		node.origin[i] = box.min[i];
+		node.exponent[i] = (int8_t) exponent;
+
+		// Worked out in double, where these are exact. Decoding origin + q * step in float rounds once,
+		// and rounding never reorders values, so a bound rounded outwards here still lies outside the child after decoding.
+		const double step = std::ldexp(1.0, exponent);
+
+		for (int slot = 0; slot < Width; ++ slot)
+		{
+			if (slot < node.childCount)
+			{
+				node.bounds[i][slot] = (uint8_t) glm::clamp((int) std::floor((childBoxes[slot].min[i] - (double) node.origin[i]) / step), 0, 255);
+				node.bounds[i + 3][slot] = (uint8_t) glm::clamp((int) std::ceil((childBoxes[slot].max[i] - (double) node.origin[i]) / step), 0, 255);
+			}
+			else
+			{
+				// Unused children get inverted boxes, which no ray can hit
+				node.bounds[i][slot] = 255;
+				node.bounds[i + 3][slot] = 0;
+			}
+		}
+	}
+}
+
+template <int Width>
+float QuantizedBoundingVolumeHierarchy<Width>::GetStep(const int8_t exponent)
+{
+	// Builds the float 2^exponent directly from its bits
+	const uint32_t bits = (uint32_t) (exponent + 127) << 23;
+
+	float step;
+	memcpy(& step, & bits, sizeof(step));
+	return step;
+}
+
+template <int Width>
+int QuantizedBoundingVolumeHierarchy<Width>::IntersectChildren(const Node & node, const PrecomputedRay & ray, const float tMax, float * outEntries) const
+{
+	static const float epsilon = 1e-6f;
+
+	int hits = 0;
+
+	for (int lane = 0; lane < Lanes; lane += SimdWidth)
+	{
+		SimdFloat tmin = std::numeric_limits<float>::lowest();
+		SimdFloat tmax = std::numeric_limits<float>::max();
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			const SimdFloat origin = SimdFloat(node.origin[i]);
+			const SimdFloat step = SimdFloat(GetStep(node.exponent[i]));
+
+			// Nodes narrower than the SIMD width load bytes past the end of the row, which are still within
+			// the node and only fill lanes that are masked off below
+			const SimdFloat nearBound = origin + SimdFloat::LoadBytes(& node.bounds[i + 3 * ray.sign[i]][lane]) * step;
+			const SimdFloat farBound = origin + SimdFloat::LoadBytes(& node.bounds[i + 3 * (1 - ray.sign[i])][lane]) * step;
+
+			// Max and Min keep their second argument when the first is NaN, matching AABB::Intersect
+			tmin = SimdFloat::Max((nearBound - SimdFloat(ray.origin[i])) * SimdFloat(ray.inverseDirection[i]), tmin);
+			tmax = SimdFloat::Min((farBound - SimdFloat(ray.origin[i])) * SimdFloat(ray.inverseDirection[i]), tmax);
+		}
+
+		// Widen the interval slightly so rounding never culls a primitive lying on the box surface
+		tmin = tmin * SimdFloat::Select(tmin > SimdFloat(0.f), SimdFloat(1.f - epsilon), SimdFloat(1.f + epsilon));
+		tmax = tmax * SimdFloat::Select(tmax > SimdFloat(0.f), SimdFloat(1.f + epsilon), SimdFloat(1.f - epsilon));
+
+		const SimdMask hit = (tmin <= tmax) & (tmax >= SimdFloat(0.f)) & (tmin <= SimdFloat(tMax));
+
+		SimdFloat::Max(tmin, SimdFloat(0.f)).Store(outEntries + lane);
+		hits |= hit.Bits() << lane;
+	}
+
+	return hits & ((1 << node.childCount) - 1);
+}
+
+template <int Width>
+bool QuantizedBoundingVolumeHierarchy<Width>::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord closest;
+	IntersectClosest(ray, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+template <int Width>
+int QuantizedBoundingVolumeHierarchy<Width>::IntersectClosest(const Ray & ray, HitRecord & closest) const
+{
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	const PrecomputedRay precomputed(ray);
+
+	// Pathologically deep trees fall back to a heap-allocated stack
+	StackEntry localStack[StackSize];
+	std::vector<StackEntry> heapStack;
+	StackEntry * stack = localStack;
+
+	if (maxDepth * Width > StackSize)
+	{
+		heapStack.resize(maxDepth * Width);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	int visitedCount = 0;
+	uint32_t current = 0;
+
+	while (true)
+	{
+		const Node & node = nodes[current];
+		visitedCount ++;
+
+		float entries[Lanes];
+		const int hits = IntersectChildren(node, precomputed, closest.t, entries);
+
+		// Sort the children that were hit nearest first
+		int order[Width];
+		int hitCount = 0;
+
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			if (! (hits & (1 << slot)))
+			{
+				continue;
+			}
+
+			int position = hitCount ++;
+
+			while (position > 0 && entries[order[position - 1]] > entries[slot])
+			{
+				order[position] = order[position - 1];
+				-- position;
+			}
+
+			order[position] = slot;
+		}
+
+		// Push the farthest child first so the nearest is visited next
+		for (int i = hitCount - 1; i >= 0; -- i)
+		{
+			stack[stackSize].node = current;
+			stack[stackSize].slot = (uint32_t) order[i];
+			stack[stackSize].entry = entries[order[i]];
+			stackSize ++;
+		}
+
+		// Pop deferred children, intersecting leaves along the way, until reaching the next interior node
+		while (true)
+		{
+			do
+			{
+				if (stackSize == 0)
+				{
+					return visitedCount;
+				}
+
+				-- stackSize;
+			}
+			while (stack[stackSize].entry > closest.t);
+
+			const Node & parent = nodes[stack[stackSize].node];
+			const uint32_t slot = stack[stackSize].slot;
+
+			if (parent.primitiveCount[slot] == 0)
+			{
+				current = parent.offset[slot];
+				break;
+			}
+
+			pools.Intersect(parent.type[slot], parent.offset[slot], parent.primitiveCount[slot], ray, closest);
+			visitedCount ++;
+		}
+	}
+}
+
+template <int Width>
+bool QuantizedBoundingVolumeHierarchy<Width>::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	const PrecomputedRay precomputed(ray);
+
+	uint32_t localStack[StackSize];
+	std::vector<uint32_t> heapStack;
+	uint32_t * stack = localStack;
+
+	if (maxDepth * Width > StackSize)
+	{
+		heapStack.resize(maxDepth * Width);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	uint32_t current = 0;
+
+	// Any hit before maxDistance will do, so leaves are tested as soon as they are found and children are not ordered
+	while (true)
+	{
+		const Node & node = nodes[current];
+
+		float entries[Lanes];
+		const int hits = IntersectChildren(node, precomputed, maxDistance, entries);
+
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			if (! (hits & (1 << slot)))
+			{
+				continue;
+			}
+
+			if (node.primitiveCount[slot] == 0)
+			{
+				stack[stackSize ++] = node.offset[slot];
+			}
+			else if (pools.IsOccluded(node.type[slot], node.offset[slot], node.primitiveCount[slot], ray, maxDistance))
+			{
+				return true;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return false;
+		}
+
+		current = stack[-- stackSize];
+	}
+}
+
+template <int Width>
+void QuantizedBoundingVolumeHierarchy<Width>::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	// Nodes already spend the SIMD lanes on the children, so rays are traced one at a time
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+		Intersect(rays[i], outHits[i]);
+	}
+}
+
+template <int Width>
+void QuantizedBoundingVolumeHierarchy<Width>::PrintTree(const std::string & name) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- branch (" << (int) nodes[0].childCount << " children)" << std::endl;
+	std::cout << std::endl;
+
+	for (int slot = 0; slot < nodes[0].childCount; ++ slot)
+	{
+		PrintChild(0, slot, name + "->child" + std::to_string(slot));
+	}
+}
+
+template <int Width>
+void QuantizedBoundingVolumeHierarchy<Width>::PrintChild(const uint32_t index, const int slot, const std::string & name) const
+{
+	const Node & node = nodes[index];
+
+	std::cout << name << ":" << std::endl;
+	const AABB box = GetChildBox(node, slot);
+
+	std::cout << "- min: " << box.min << std::endl;
+	std::cout << "- max: " << box.max << std::endl;
+
+	if (node.primitiveCount[slot])
+	{
+		std::cout << "- leaf" << std::endl;
+
+		for (uint32_t i = node.offset[slot]; i < node.offset[slot] + node.primitiveCount[slot]; ++ i)
+		{
+			const Object * object = pools.GetObject(node.type[slot], i);
+			std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+		}
+
+		std::cout << std::endl;
+	}
+	else
+	{
+		const Node & child = nodes[node.offset[slot]];
+
+		std::cout << "- branch (" << (int) child.childCount << " children)" << std::endl;
+		std::cout << std::endl;
+
+		for (int childSlot = 0; childSlot < child.childCount; ++ childSlot)
+		{
+			PrintChild(node.offset[slot], childSlot, name + "->child" + std::to_string(childSlot));
+		}
+	}
+}
+
+template <int Width>
+AABB QuantizedBoundingVolumeHierarchy<Width>::GetChildBox(const Node & node, const int slot) const
+{
+	AABB box;
+
+	for (int i = 0; i < 3; ++ i)
+	{
+		const float step = GetStep(node.exponent[i]);
+
+		box.min[i] = node.origin[i] + node.bounds[i][slot] * step;
+		box.max[i] = node.origin[i] + node.bounds[i + 3][slot] * step;
+	}
+
+	return box;
+}
+
+template <int Width>
+float QuantizedBoundingVolumeHierarchy<Width>::GetSAHCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.f;
+	}
+
+	AABB rootBox;
+	for (int slot = 0; slot < nodes[0].childCount; ++ slot)
+	{
+		rootBox.AddBox(GetChildBox(nodes[0], slot));
+	}
+
+	const float rootArea = rootBox.GetSurfaceArea();
+
+	// Every ray visits the root, and every other node is the child in one slot of its parent
+	float cost = TraversalCost;
+
+	for (const Node & node : nodes)
+	{
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			const float probability = rootArea > 0 ? GetChildBox(node, slot).GetSurfaceArea() / rootArea : 1.f;
+			cost += probability * (node.primitiveCount[slot] ? (float) node.primitiveCount[slot] : TraversalCost);
+		}
+	}
+
+	return cost;
+}
+
+template <int Width>
+SpatialDataStructure::Statistics QuantizedBoundingVolumeHierarchy<Width>::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (nodes.size())
+	{
+		GatherStatistics(0, 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+	statistics.nodeBytes = nodes.size() * sizeof(Node);
+	statistics.primitiveBytes = pools.GetMemoryUsage();
+	return statistics;
+}
+
+template <int Width>
+void QuantizedBoundingVolumeHierarchy<Width>::GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const
+{
+	const Node & node = nodes[index];
+
+	AABB childBoxes[Width];
+	for (int slot = 0; slot < node.childCount; ++ slot)
+	{
+		childBoxes[slot] = GetChildBox(node, slot);
+	}
+
+	statistics.AddInterior(childBoxes, node.childCount);
+
+	for (int slot = 0; slot < node.childCount; ++ slot)
+	{
+		if (node.primitiveCount[slot])
+		{
+			statistics.AddLeaf(depth + 1, node.primitiveCount[slot]);
+		}
+		else
+		{
+			GatherStatistics(node.offset[slot], depth + 1, statistics);
+		}
+	}
+}
+
+template <int Width>
+int QuantizedBoundingVolumeHierarchy<Width>::CountVisitedNodes(const Ray & ray) const
+{
+	HitRecord closest;
+	return IntersectClosest(ray, closest);
+}
+
+template <int Width>
+const NodeArray<typename QuantizedBoundingVolumeHierarchy<Width>::Node> & QuantizedBoundingVolumeHierarchy<Width>::GetNodes() const
+{
+	return nodes;
+}
+
+template <int Width>
+const PrimitivePools & QuantizedBoundingVolumeHierarchy<Width>::GetPools() const
+{
+	return pools;
+}
+
+template <int Width>
+int QuantizedBoundingVolumeHierarchy<Width>::GetMaxDepth() const
+{
+	return maxDepth;
+}
+
+template class QuantizedBoundingVolumeHierarchy<2>;
+template class QuantizedBoundingVolumeHierarchy<4>;
+template class QuantizedBoundingVolumeHierarchy<8>;
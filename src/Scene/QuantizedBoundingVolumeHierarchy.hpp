@@ -0,0 +1,111 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "FlatBoundingVolumeHierarchy.hpp"
+#include "PrimitivePools.hpp"
+#include "SpatialDataStructure.hpp"
+#include "NodeArray.hpp"
+
+#include <RayTracer/Simd.hpp>
+#include <RayTracer/MappedFile.hpp>
+
+
+// A binary hierarchy collapsed into nodes with up to Width children, like WideBoundingVolumeHierarchy,
+// but storing each child's bounds as 8-bit steps across its parent's box instead of floats.
+// A node takes 16 + 12 * Width bytes: 64 for width 4, against 128 for a float node of the same width.
+//
+// Steps are powers of two, so decoding a bound is a single exact multiply-add, and bounds are rounded
+// outwards so that a decoded child box always contains the child. Rays visit a few more nodes through
+// the looser boxes, but find exactly the same hits.
+template <int Width>
+class QuantizedBoundingVolumeHierarchy : public SpatialDataStructure
+{
+
+public:
+
+	// Nodes narrower than the SIMD width are padded with empty children
+	static const int Lanes = Width < SimdWidth ? SimdWidth : Width;
+
+	struct Node
+	{
+		// Minimum of the node's box, and the step between quantized bounds as a power of two, per axis
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t childCount = 0;
+
+		// Child bounds in steps from the origin, indexed by axis for the minimum and by axis + 3 for the maximum
+		uint8_t bounds[6][Width];
+
+		// Interior children: index of the child node. Leaf children: index of the first primitive in the pool for the leaf's type.
+		uint32_t offset[Width];
+
+		// Zero for interior children
+		uint8_t primitiveCount[Width];
+
+		PrimitivePools::Type type[Width];
+	};
+
+	static_assert(sizeof(Node) == 16 + 12 * Width, "QuantizedBoundingVolumeHierarchy::Node should not be padded");
+	static_assert(FlatBoundingVolumeHierarchy::MaxLeafSize <= 255, "Leaf sizes should fit in a byte");
+
+	QuantizedBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy & binary);
+
+	// Uses nodes that live in a mapped file, taking ownership of the file
+	QuantizedBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth);
+	~QuantizedBoundingVolumeHierarchy();
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+	void PrintTree(const std::string & name) const;
+
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	const NodeArray<Node> & GetNodes() const;
+	const PrimitivePools & GetPools() const;
+	int GetMaxDepth() const;
+
+protected:
+
+	static const int StackSize = 256;
+
+	// Exponents of the smallest and largest steps, so that every step is a normal float
+	static const int MinExponent = -126;
+	static const int MaxExponent = 127;
+
+	struct StackEntry
+	{
+		uint32_t node;
+		uint32_t slot;
+		float entry;
+	};
+
+	uint32_t Collapse(const NodeArray<FlatBoundingVolumeHierarchy::Node> & binaryNodes, const uint32_t binaryIndex, const int depth);
+
+	// Sets the node's origin and steps to cover the child boxes, and each child's bounds to enclose its box
+	static void Quantize(Node & node, const AABB * childBoxes);
+	static float GetStep(const int8_t exponent);
+
+	int IntersectChildren(const Node & node, const PrecomputedRay & ray, const float tMax, float * outEntries) const;
+
+	// Returns the number of nodes visited, counting each leaf child as a node
+	int IntersectClosest(const Ray & ray, HitRecord & closest) const;
+	void PrintChild(const uint32_t index, const int slot, const std::string & name) const;
+	AABB GetChildBox(const Node & node, const int slot) const;
+	void GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const;
+
+	NodeArray<Node> nodes;
+	PrimitivePools pools;
+	int maxDepth = 0;
+	MappedFile * mappedFile = nullptr;
+
+};
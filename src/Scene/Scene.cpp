@@ -4,8 +4,19 @@
 
 
 #include "Scene.hpp"
+#include "FlatBoundingVolumeHierarchy.hpp"
+#include "WideBoundingVolumeHierarchy.hpp"
+#include "QuantizedBoundingVolumeHierarchy.hpp"
+#include "LazyBoundingVolumeHierarchy.hpp"
+#include "KdTree.hpp"
+#include "Grid.hpp"
+#include "BvhCache.hpp"
+#include "SpatialDataStructureChooser.hpp"
 
 #include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <chrono>
 
 
 Object * Scene::AddObject(Object * object)
@@ -21,6 +32,12 @@ Light * Scene::AddLight(Light * light)
 	return light;
 }
 
+Mesh * Scene::AddMesh(Mesh * mesh)
+{
+	meshes.push_back(mesh);
+	return mesh;
+}
+
 const std::vector<Object *> & Scene::GetObjects() const
 {
 	return objects;
@@ -31,6 +48,11 @@ const std::vector<Light *> & Scene::GetLights() const
 	return lights;
 }
 
+const std::vector<Mesh *> & Scene::GetMeshes() const
+{
+	return meshes;
+}
+
 Camera const & Scene::GetCamera() const
 {
 	return camera;
@@ -53,87 +75,113 @@ bool Scene::IsLightOccluded(const glm::vec3 & point, const glm::vec3 & lightPosi
 		currentIteration->shadowRays.back().ray = ray;
 	}
 
-	if (spatialDataStructure)
+	if (IsOccluded(ray, lightDistance))
 	{
-		float t;
-		const Object * object = nullptr;
-
-		if (spatialDataStructure->Intersect(ray, t, object))
+		if (currentIteration)
 		{
-			if (t >= 0.f && t < lightDistance)
-			{
-				if (currentIteration)
-				{
-					currentIteration->shadowRays.back().hit = true;
-				}
-				return true;
-			}
+			currentIteration->shadowRays.back().hit = true;
 		}
+		return true;
 	}
 
-	for (auto Object : objects)
+	return false;
+}
+
+bool Scene::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	// Planes are never stored in the spatial data structure and are cheap to test, so check them first
+	for (const Object * object : objects)
 	{
-		const float t = Object->IntersectTransformed(ray);
-		if (t >= 0.f && t < lightDistance)
+		HitRecord hit;
+		if (object->IntersectTransformed(ray, hit) && hit.t < maxDistance)
 		{
-			if (currentIteration)
-			{
-				currentIteration->shadowRays.back().hit = true;
-			}
 			return true;
 		}
 	}
 
+	if (spatialDataStructure)
+	{
+		return spatialDataStructure->IsOccluded(ray, maxDistance);
+	}
+
 	return false;
 }
 
 RayHitResults Scene::GetRayHitResults(const Ray & ray) const
 {
-	RayHitResults results;
+	HitRecord closest;
 
 	if (spatialDataStructure)
 	{
-		float t;
-		const Object * object = nullptr;
+		spatialDataStructure->Intersect(ray, closest);
+	}
+
+	IntersectObjects(ray, closest);
+	return FinalizeHit(ray, closest);
+}
+
+void Scene::GetRayHitResults(const Ray * rays, const int count, RayHitResults * outResults) const
+{
+	if (! spatialDataStructure)
+	{
+		for (int i = 0; i < count; ++ i)
+		{
+			outResults[i] = GetRayHitResults(rays[i]);
+		}
+		return;
+	}
+
+	for (int packetStart = 0; packetStart < count; packetStart += SimdWidth)
+	{
+		const int packetSize = glm::min(SimdWidth, count - packetStart);
+
+		HitRecord packetHits[SimdWidth];
+		spatialDataStructure->IntersectPacket(rays + packetStart, packetSize, packetHits);
 
-		if (spatialDataStructure->Intersect(ray, t, object))
+		for (int i = 0; i < packetSize; ++ i)
 		{
-			results.object = object;
-			results.t = t;
+			const Ray & ray = rays[packetStart + i];
+
+			IntersectObjects(ray, packetHits[i]);
+			outResults[packetStart + i] = FinalizeHit(ray, packetHits[i]);
 		}
 	}
+}
 
+void Scene::IntersectObjects(const Ray & ray, HitRecord & closest) const
+{
 	for (const Object * object : objects)
 	{
-		const float t = object->IntersectTransformed(ray);
-		if (t >= 0.f)
+		HitRecord hit;
+		if (object->IntersectTransformed(ray, hit) && hit.t < closest.t)
 		{
-			if (! results.object || t < results.t)
-			{
-				results.object = object;
-				results.t = t;
-			}
+			closest = hit;
 		}
 	}
+}
+
+RayHitResults Scene::FinalizeHit(const Ray & ray, const HitRecord & hit)
+{
+	RayHitResults results;
 
-	if (results.object)
+	// The point and normal are only worked out for the closest hit
+	if (hit.object)
 	{
-		results.point = ray.GetPoint(results.t);
-		results.normal = results.object->CalculateNormalTransformed(results.point);
+		static_cast<HitRecord &>(results) = hit;
+		results.point = ray.GetPoint(hit.t);
+		results.normal = hit.object->CalculateNormalTransformed(hit, results.point);
 	}
 
 	return results;
 }
 
-void Scene::BuildSpatialDataStructure()
+void Scene::BuildSpatialDataStructure(const Params & params)
 {
-	std::vector<const Object *> nonPlane;
-
 	for (Object * & object : objects)
 	{
-		if (object->GetObjectType() != "Plane")
+		if (object->GetType() != ObjectType::Plane)
 		{
-			nonPlane.push_back(object);
+			spatialObjects.push_back(object);
 			object = nullptr;
 		}
 	}
@@ -141,11 +189,193 @@ void Scene::BuildSpatialDataStructure()
 	// Remove all nullptrs
 	objects.erase(std::remove(objects.begin(), objects.end(), nullptr), objects.end());
 
-	spatialDataStructure = new BoundingVolumeNode(nonPlane);
-	spatialDataStructure->BuildTree(0);
+	delete spatialDataStructure;
+	spatialDataStructure = nullptr;
+
+	const auto buildStart = std::chrono::steady_clock::now();
+
+	const bool useCache = params.bvhCacheFileName.size() && params.spatialDataStructureType == SpatialDataStructureType::BoundingVolumeHierarchy;
+
+	if (useCache)
+	{
+		spatialDataStructure = BvhCache::Load(params, spatialObjects, spatialDataStructureDescription);
+	}
+
+	if (! spatialDataStructure)
+	{
+		spatialDataStructure = CreateSpatialDataStructure(spatialObjects, params, spatialDataStructureDescription);
+
+		if (useCache && ! BvhCache::Save(params, spatialDataStructure, spatialDataStructureDescription))
+		{
+			std::cerr << "Failed to write bvh cache file '" << params.bvhCacheFileName << "'." << std::endl;
+		}
+	}
+
+	spatialDataStructureBuildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+
+	if (meshes.size())
+	{
+		spatialDataStructureDescription += ", over instances of " + std::to_string(meshes.size()) + " mesh(es)";
+	}
+}
+
+std::string Scene::ChooseSpatialDataStructure(Params & params) const
+{
+	// Planes are tested one by one whatever the choice
+	std::vector<const Object *> candidates = spatialObjects;
+
+	for (const Object * object : objects)
+	{
+		if (object->GetType() != ObjectType::Plane)
+		{
+			candidates.push_back(object);
+		}
+	}
+
+	return SpatialDataStructureChooser::Choose(candidates, lights.size(), params);
 }
 
-BoundingVolumeNode * Scene::GetSpatialDataStructure()
+void Scene::BuildMeshSpatialDataStructures(const Params & params)
+{
+	// Mesh geometry never moves within its own object space, so each hierarchy is built only once
+	for (Mesh * mesh : meshes)
+	{
+		if (! mesh->GetSpatialDataStructure())
+		{
+			std::string description;
+			mesh->SetSpatialDataStructure(CreateSpatialDataStructure(mesh->GetObjects(), params, description));
+		}
+	}
+}
+
+SpatialDataStructure * Scene::CreateSpatialDataStructure(const std::vector<const Object *> & objects, const Params & params, std::string & outDescription)
+{
+	if (params.spatialDataStructureType == SpatialDataStructureType::KdTree)
+	{
+		KdTree * tree = new KdTree(objects);
+		outDescription = "kd-tree (sah, depth " + std::to_string(tree->GetMaxDepth()) + ")";
+		return tree;
+	}
+
+	if (params.spatialDataStructureType == SpatialDataStructureType::Grid)
+	{
+		Grid * grid = new Grid(objects);
+		const glm::ivec3 resolution = grid->GetResolution();
+		outDescription = "grid (" + std::to_string(resolution.x) + " x " + std::to_string(resolution.y) + " x " + std::to_string(resolution.z) +
+			" cells, " + std::to_string(grid->GetSubGridCount()) + " sub-grids)";
+		return grid;
+	}
+
+	const size_t leafSize = (size_t) glm::clamp(params.bvhLeafSize, 1, FlatBoundingVolumeHierarchy::MaxLeafSize);
+
+	if (params.lazyBvhBuild)
+	{
+		std::ostringstream description;
+		description << "lazy " << (params.bvhBuildMethod == BvhBuildMethod::Median ? "median split" : "sah") << ", leaf size " << leafSize << ", width 2";
+		outDescription = description.str();
+
+		return new LazyBoundingVolumeHierarchy(objects, params.bvhBuildMethod, leafSize, params.threadCount);
+	}
+
+	BoundingVolumeNode * root = BoundingVolumeNode::Build(objects, params.bvhBuildMethod, leafSize, params.spatialSplitBudget, params.threadCount);
+
+	std::ostringstream description;
+
+	switch (params.bvhBuildMethod)
+	{
+	case BvhBuildMethod::Median:
+		description << "median split";
+		break;
+
+	case BvhBuildMethod::SurfaceAreaHeuristic:
+		description << "sah";
+		break;
+
+	case BvhBuildMethod::Morton:
+		description << "lbvh (" << BoundingVolumeNode::GetMortonCodeBits(objects.size()) << "-bit morton codes)";
+		break;
+
+	case BvhBuildMethod::SpatialSplit:
+		description << "sbvh (split budget " << params.spatialSplitBudget << ")";
+		break;
+	}
+
+	description << ", leaf size " << leafSize << ", width " << params.bvhWidth;
+
+	if (params.quantizeBvh)
+	{
+		description << ", quantized";
+	}
+
+	if (params.treeletPasses > 0)
+	{
+		const float initialCost = root->GetSAHCost();
+		root->RestructureTreelets(params.treeletPasses, params.threadCount);
+
+		description << ", " << params.treeletPasses << " treelet restructuring pass(es) (sah cost " << initialCost << " -> " << root->GetSAHCost() << ")";
+	}
+
+	outDescription = description.str();
+
+	// The pointer-based tree is only needed during construction
+	FlatBoundingVolumeHierarchy * binary = new FlatBoundingVolumeHierarchy(root);
+	delete root;
+
+	if (params.quantizeBvh)
+	{
+		SpatialDataStructure * quantized = nullptr;
+
+		switch (params.bvhWidth)
+		{
+		case 4:
+			quantized = new QuantizedBoundingVolumeHierarchy<4>(* binary);
+			break;
+
+		case 8:
+			quantized = new QuantizedBoundingVolumeHierarchy<8>(* binary);
+			break;
+
+		default:
+			quantized = new QuantizedBoundingVolumeHierarchy<2>(* binary);
+			break;
+		}
+
+		delete binary;
+		return quantized;
+	}
+
+	switch (params.bvhWidth)
+	{
+	case 4:
+	{
+		SpatialDataStructure * wide = new WideBoundingVolumeHierarchy<4>(* binary);
+		delete binary;
+		return wide;
+	}
+
+	case 8:
+	{
+		SpatialDataStructure * wide = new WideBoundingVolumeHierarchy<8>(* binary);
+		delete binary;
+		return wide;
+	}
+
+	default:
+		return binary;
+	}
+}
+
+SpatialDataStructure * Scene::GetSpatialDataStructure()
 {
 	return spatialDataStructure;
 }
+
+const std::string & Scene::GetSpatialDataStructureDescription() const
+{
+	return spatialDataStructureDescription;
+}
+
+double Scene::GetSpatialDataStructureBuildSeconds() const
+{
+	return spatialDataStructureBuildSeconds;
+}
@@ -11,16 +11,18 @@
 #include "Camera.hpp"
 #include "Light.hpp"
 #include "BoundingVolumeNode.hpp"
+#include "SpatialDataStructure.hpp"
+#include "Mesh.hpp"
 
 #include <RayTracer/PixelContext.hpp>
+#include <RayTracer/Params.hpp>
 
 
-struct RayHitResults
+// The closest hit along a ray, with its point and normal filled in for shading
+struct RayHitResults : HitRecord
 {
-	float t = 0;
 	glm::vec3 point;
 	glm::vec3 normal;
-	const Object * object = nullptr;
 };
 
 class Scene
@@ -36,25 +38,47 @@ public:
 
 	Object * AddObject(Object * object);
 	Light * AddLight(Light * light);
+	Mesh * AddMesh(Mesh * mesh);
 
 	const std::vector<Object *> & GetObjects() const;
 	const std::vector<Light *> & GetLights() const;
+	const std::vector<Mesh *> & GetMeshes() const;
 
 	const Camera & GetCamera() const;
 	Camera & GetCamera();
 
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
 	bool IsLightOccluded(const glm::vec3 & point, const glm::vec3 & lightPosition, PixelContext::Iteration * currentIteration = nullptr) const;
 	RayHitResults GetRayHitResults(const Ray & ray) const;
-	void BuildSpatialDataStructure();
-	BoundingVolumeNode * GetSpatialDataStructure();
+	void GetRayHitResults(const Ray * rays, const int count, RayHitResults * outResults) const;
+	void BuildSpatialDataStructure(const Params & params);
+
+	// Sets params to the spatial data structure expected to render fastest, returning a description of the choice
+	std::string ChooseSpatialDataStructure(Params & params) const;
+	void BuildMeshSpatialDataStructures(const Params & params);
+
+	SpatialDataStructure * GetSpatialDataStructure();
+	const std::string & GetSpatialDataStructureDescription() const;
+
+	// Wall-clock time the last build of the spatial data structure took, or loading it from a cache
+	double GetSpatialDataStructureBuildSeconds() const;
 
 protected:
 
+	// Tests the objects kept outside the spatial data structure
+	void IntersectObjects(const Ray & ray, HitRecord & closest) const;
+	static RayHitResults FinalizeHit(const Ray & ray, const HitRecord & hit);
+	static SpatialDataStructure * CreateSpatialDataStructure(const std::vector<const Object *> & objects, const Params & params, std::string & outDescription);
+
 	Camera camera;
 
 	std::vector<Object *> objects;
 	std::vector<Light *> lights;
+	std::vector<Mesh *> meshes;
 
-	BoundingVolumeNode * spatialDataStructure = nullptr;
+	SpatialDataStructure * spatialDataStructure = nullptr;
+	std::vector<const Object *> spatialObjects;
+	std::string spatialDataStructureDescription;
+	double spatialDataStructureBuildSeconds = 0;
 
 };
@@ -0,0 +1,47 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "SpatialDataStructure.hpp"
+
+
+const float SpatialDataStructure::TraversalCost = 1.f;
+
+void SpatialDataStructure::Statistics::AddLeaf(const int depth, const size_t primitiveCount)
+{
+	if ((int) leafDepths.size() <= depth)
+	{
+		leafDepths.resize(depth + 1, 0);
+	}
+
+	if (leafSizes.size() <= primitiveCount)
+	{
+		leafSizes.resize(primitiveCount + 1, 0);
+	}
+
+	leafDepths[depth] ++;
+	leafSizes[primitiveCount] ++;
+	leafCount ++;
+	primitiveReferenceCount += primitiveCount;
+}
+
+void SpatialDataStructure::Statistics::AddInterior(const AABB * childBoxes, const int childCount)
+{
+	interiorCount ++;
+
+	for (int i = 0; i < childCount; ++ i)
+	{
+		childArea += childBoxes[i].GetSurfaceArea();
+
+		for (int j = i + 1; j < childCount; ++ j)
+		{
+			const glm::vec3 min = glm::max(childBoxes[i].min, childBoxes[j].min);
+			const glm::vec3 max = glm::min(childBoxes[i].max, childBoxes[j].max);
+
+			if (max.x >= min.x && max.y >= min.y && max.z >= min.z)
+			{
+				siblingOverlapArea += AABB(min, max).GetSurfaceArea();
+			}
+		}
+	}
+}
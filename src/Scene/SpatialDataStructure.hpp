@@ -0,0 +1,72 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "AABB.hpp"
+#include "Object.hpp"
+
+#include <RayTracer/Ray.hpp>
+
+
+// The ray queries Scene needs from an acceleration structure over its objects
+class SpatialDataStructure
+{
+
+public:
+
+	// Shape and size of a built structure, for comparing builds
+	struct Statistics
+	{
+		size_t interiorCount = 0;
+		size_t leafCount = 0;
+		size_t primitiveReferenceCount = 0;
+
+		// Number of leaves at each depth, the root being at depth one, and holding each number of primitives
+		std::vector<size_t> leafDepths;
+		std::vector<size_t> leafSizes;
+
+		// Summed over interior nodes: the surface area shared by each pair of children, and the surface area of every child
+		double siblingOverlapArea = 0;
+		double childArea = 0;
+
+		float sahCost = 0;
+		size_t nodeBytes = 0;
+		size_t primitiveBytes = 0;
+
+		void AddLeaf(const int depth, const size_t primitiveCount);
+		void AddInterior(const AABB * childBoxes, const int childCount);
+	};
+
+	virtual ~SpatialDataStructure() = default;
+
+	// Finds the closest hit, returning false if nothing is hit
+	virtual bool Intersect(const Ray & ray, HitRecord & outHit) const = 0;
+
+	// Returns true as soon as anything is hit closer than maxDistance
+	virtual bool IsOccluded(const Ray & ray, const float maxDistance) const = 0;
+
+	// Finds the closest hit for each of up to SimdWidth rays; misses are left with a null object
+	virtual void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const = 0;
+
+	virtual void PrintTree(const std::string & name) const = 0;
+
+	// Expected cost of tracing a ray through the structure under the surface area heuristic,
+	// in units of primitive intersection tests
+	virtual float GetSAHCost() const = 0;
+
+	virtual Statistics GetStatistics() const = 0;
+
+	// Traces the ray as Intersect does, returning the number of nodes it visited, leaves included
+	virtual int CountVisitedNodes(const Ray & ray) const = 0;
+
+protected:
+
+	// Cost of visiting one node, relative to intersecting one primitive
+	static const float TraversalCost;
+
+};
@@ -0,0 +1,124 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "SpatialDataStructureChooser.hpp"
+#include "Grid.hpp"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+
+const float SpatialDataStructureChooser::PrimitiveTestCost = 10.f;
+const float SpatialDataStructureChooser::InstanceTestCost = 100.f;
+const float SpatialDataStructureChooser::BvhLevelCost = 40.f;
+const float SpatialDataStructureChooser::MortonTraversalFactor = 1.2f;
+const float SpatialDataStructureChooser::SahBuildCost = 300.f;
+const float SpatialDataStructureChooser::MortonBuildCost = 1500.f;
+const float SpatialDataStructureChooser::GridCellCost = 25.f;
+const float SpatialDataStructureChooser::GridBuildCost = 40.f;
+
+std::string SpatialDataStructureChooser::Choose(const std::vector<const Object *> & objects, const size_t lightCount, Params & params)
+{
+	// Nothing to search, and no bounds to estimate a grid from
+	if (objects.empty())
+	{
+		params.useSpatialDataStructure = false;
+		return "sds: none, chosen for 0 objects";
+	}
+
+	const double objectCount = (double) objects.size();
+
+	// Every sample casts a camera ray and a shadow ray per light; reflection and refraction are left out
+	const double rayCount = (double) params.imageSize.x * params.imageSize.y * params.superSampling * params.superSampling * (1 + lightCount);
+	const double threadCount = glm::max(params.threadCount, 1);
+
+	AABB bounds;
+	double testCost = 0;
+
+	for (const Object * object : objects)
+	{
+		bounds.AddBox(object->GetBoundingBox());
+		testCost += object->GetType() == ObjectType::Instance ? InstanceTestCost : PrimitiveTestCost;
+	}
+
+	testCost /= objectCount;
+
+	// Object references in the top level of the grid. Long or large objects fill many cells,
+	// and clumped objects leave cells crowded, each driving up the tests per cell.
+	const glm::ivec3 resolution = Grid::ChooseResolution(bounds, objects.size());
+	const glm::vec3 extent = bounds.max - bounds.min;
+	const double cellCount = (double) resolution.x * resolution.y * resolution.z;
+	double referenceCount = 0;
+
+	for (const Object * object : objects)
+	{
+		const AABB box = object->GetBoundingBox();
+		double cells = 1;
+
+		for (int axis = 0; axis < 3; ++ axis)
+		{
+			// Unbounded objects, such as planes, leave a single cell along every axis
+			if (resolution[axis] > 1)
+			{
+				const int low = glm::clamp((int) std::floor((box.min[axis] - bounds.min[axis]) / extent[axis] * resolution[axis]), 0, resolution[axis] - 1);
+				const int high = glm::clamp((int) std::floor((box.max[axis] - bounds.min[axis]) / extent[axis] * resolution[axis]), 0, resolution[axis] - 1);
+				cells *= high - low + 1;
+			}
+		}
+
+		referenceCount += cells;
+	}
+
+	// A ray crosses about as many cells as the grid is wide, and a hit ends it about halfway through
+	const double cellsCrossed = std::max((resolution.x + resolution.y + resolution.z) / 6.0, 1.0);
+	const double levels = std::log2(std::max(objectCount, 2.0));
+
+	enum Choice { NoStructure, UniformGrid, MortonBvh, SahBvh, ChoiceCount };
+	static const char * const names[ChoiceCount] = { "none", "grid", "lbvh", "sah bvh" };
+
+	double buildCost[ChoiceCount], rayCost[ChoiceCount];
+
+	buildCost[NoStructure] = 0;
+	rayCost[NoStructure] = objectCount * testCost;
+
+	buildCost[UniformGrid] = GridBuildCost * (referenceCount + cellCount);
+	rayCost[UniformGrid] = cellsCrossed * (GridCellCost + testCost * referenceCount / cellCount);
+
+	buildCost[MortonBvh] = MortonBuildCost * objectCount;
+	rayCost[MortonBvh] = MortonTraversalFactor * BvhLevelCost * levels + testCost;
+
+	buildCost[SahBvh] = SahBuildCost * objectCount * levels;
+	rayCost[SahBvh] = BvhLevelCost * levels + testCost;
+
+	double seconds[ChoiceCount];
+	int best = NoStructure;
+
+	for (int choice = 0; choice < ChoiceCount; ++ choice)
+	{
+		seconds[choice] = (buildCost[choice] + rayCost[choice] * rayCount / threadCount) * 1e-9;
+
+		if (seconds[choice] < seconds[best])
+		{
+			best = choice;
+		}
+	}
+
+	params.useSpatialDataStructure = best != NoStructure;
+	params.spatialDataStructureType = best == UniformGrid ? SpatialDataStructureType::Grid : SpatialDataStructureType::BoundingVolumeHierarchy;
+	params.bvhBuildMethod = best == MortonBvh ? BvhBuildMethod::Morton : BvhBuildMethod::SurfaceAreaHeuristic;
+
+	std::ostringstream description;
+	description << std::fixed << std::setprecision(3);
+	description << "sds: " << names[best] << ", chosen for " << objects.size() << " objects and " << (long long) rayCount << " rays (estimated";
+
+	for (int choice = 0; choice < ChoiceCount; ++ choice)
+	{
+		description << (choice ? ", " : " ") << names[choice] << " " << seconds[choice] << "s";
+	}
+
+	description << ")";
+	return description.str();
+}
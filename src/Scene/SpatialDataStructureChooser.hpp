@@ -0,0 +1,48 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Object.hpp"
+#include <RayTracer/Params.hpp>
+
+
+// Picks how ray queries are accelerated when no flag says so: testing every object, a grid,
+// or a bvh built quickly (lbvh) or well (sah). Each choice's build and trace time is estimated
+// from the object count and type mix, how the objects fill the scene's bounds, and how many rays
+// the image needs, and the choice with the lowest total wins.
+//
+// Costs are rough nanosecond timings from a desktop CPU; only their ratios affect the choice.
+class SpatialDataStructureChooser
+{
+
+public:
+
+	// Sets the spatial data structure params for rendering params.imageSize, returning a description of the choice
+	static std::string Choose(const std::vector<const Object *> & objects, const size_t lightCount, Params & params);
+
+protected:
+
+	// Testing a ray against one object. An instance transforms the ray and traverses its mesh's own hierarchy.
+	static const float PrimitiveTestCost;
+	static const float InstanceTestCost;
+
+	// Visiting a bvh node, per level of the tree
+	static const float BvhLevelCost;
+
+	// An lbvh is visited this much more than a sah bvh over the same objects
+	static const float MortonTraversalFactor;
+
+	// Building a sah bvh, per object per level, and an lbvh, per object
+	static const float SahBuildCost;
+	static const float MortonBuildCost;
+
+	// Stepping into a grid cell, and filling in one object reference
+	static const float GridCellCost;
+	static const float GridBuildCost;
+
+};
@@ -0,0 +1,496 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#include "WideBoundingVolumeHierarchy.hpp"
+
+#include <iostream>
+#include <limits>
+
+
+template <int Width>
+WideBoundingVolumeHierarchy<Width>::WideBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy & binary)
+{
+	// Leaves keep referring to the same primitive ranges, so the pools are shared as-is
+	pools = binary.GetPools();
+
+	if (binary.GetNodes().size())
+	{
+		Collapse(binary.GetNodes(), 0, 1);
+	}
+}
+
+template <int Width>
+WideBoundingVolumeHierarchy<Width>::WideBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth)
+{
+	this->nodes.Adopt(nodes, nodeCount);
+	this->pools = pools;
+	this->maxDepth = maxDepth;
+	mappedFile = file;
+}
+
+template <int Width>
+WideBoundingVolumeHierarchy<Width>::~WideBoundingVolumeHierarchy()
+{
+	delete mappedFile;
+}
+
+template <int Width>
+uint32_t WideBoundingVolumeHierarchy<Width>::Collapse(const NodeArray<FlatBoundingVolumeHierarchy::Node> & binaryNodes, const uint32_t binaryIndex, const int depth)
+{
+	std::vector<uint32_t> children;
+
+	if (binaryNodes[binaryIndex].primitiveCount)
+	{
+		children.push_back(binaryIndex);
+	}
+	else
+	{
+		children.push_back(binaryIndex + 1);
+		children.push_back(binaryNodes[binaryIndex].offset);
+	}
+
+	// Pull grandchildren up by repeatedly opening the interior child with the largest surface area
+	while ((int) children.size() < Width)
+	{
+		int largest = -1;
+		float largestArea = -1.f;
+
+		for (int i = 0; i < (int) children.size(); ++ i)
+		{
+			const FlatBoundingVolumeHierarchy::Node & child = binaryNodes[children[i]];
+
+			if (child.primitiveCount == 0 && child.box.GetSurfaceArea() > largestArea)
+			{
+				largest = i;
+				largestArea = child.box.GetSurfaceArea();
+			}
+		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		const uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children.push_back(binaryNodes[opened].offset);
+	}
+
+	const uint32_t index = (uint32_t) nodes.size();
+
+	nodes.push_back(Node());
+	maxDepth = glm::max(maxDepth, depth);
+
+	Node & node = nodes[index];
+	node.childCount = (uint8_t) children.size();
+
+	// Unused lanes hold inverted boxes, which no ray can hit
+	for (int lane = 0; lane < Lanes; ++ lane)
+	{
+		for (int i = 0; i < 3; ++ i)
+		{
+			node.bounds[i][lane] = std::numeric_limits<float>::max();
+			node.bounds[i + 3][lane] = std::numeric_limits<float>::lowest();
+		}
+	}
+
+	for (int slot = 0; slot < (int) children.size(); ++ slot)
+	{
+		const FlatBoundingVolumeHierarchy::Node & child = binaryNodes[children[slot]];
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			node.bounds[i][slot] = child.box.min[i];
+			node.bounds[i + 3][slot] = child.box.max[i];
+		}
+
+		node.offset[slot] = child.offset;
+		node.primitiveCount[slot] = child.primitiveCount;
+		node.type[slot] = child.type;
+	}
+
+	// Collapsing the children grows the node array, so the reference above cannot be used past this point
+	for (int slot = 0; slot < (int) children.size(); ++ slot)
+	{
+		if (binaryNodes[children[slot]].primitiveCount == 0)
+		{
+			const uint32_t childIndex = Collapse(binaryNodes, children[slot], depth + 1);
+			nodes[index].offset[slot] = childIndex;
+		}
+	}
+
+	return index;
+}
+
+template <int Width>
+int WideBoundingVolumeHierarchy<Width>::IntersectChildren(const Node & node, const PrecomputedRay & ray, const float tMax, float * outEntries) const
+{
+	static const float epsilon = 1e-6f;
+
+	int hits = 0;
+
+	for (int lane = 0; lane < Lanes; lane += SimdWidth)
+	{
+		SimdFloat tmin = std::numeric_limits<float>::lowest();
+		SimdFloat tmax = std::numeric_limits<float>::max();
+
+		for (int i = 0; i < 3; ++ i)
+		{
+			const SimdFloat nearBound = SimdFloat::Load(& node.bounds[i + 3 * ray.sign[i]][lane]);
+			const SimdFloat farBound = SimdFloat::Load(& node.bounds[i + 3 * (1 - ray.sign[i])][lane]);
+
+			// Max and Min keep their second argument when the first is NaN, matching AABB::Intersect
+			tmin = SimdFloat::Max((nearBound - SimdFloat(ray.origin[i])) * SimdFloat(ray.inverseDirection[i]), tmin);
+			tmax = SimdFloat::Min((farBound - SimdFloat(ray.origin[i])) * SimdFloat(ray.inverseDirection[i]), tmax);
+		}
+
+		// Widen the interval slightly so rounding never culls a primitive lying on the box surface
+		tmin = tmin * SimdFloat::Select(tmin > SimdFloat(0.f), SimdFloat(1.f - epsilon), SimdFloat(1.f + epsilon));
+		tmax = tmax * SimdFloat::Select(tmax > SimdFloat(0.f), SimdFloat(1.f + epsilon), SimdFloat(1.f - epsilon));
+
+		const SimdMask hit = (tmin <= tmax) & (tmax >= SimdFloat(0.f)) & (tmin <= SimdFloat(tMax));
+
+		SimdFloat::Max(tmin, SimdFloat(0.f)).Store(outEntries + lane);
+		hits |= hit.Bits() << lane;
+	}
+
+	return hits & ((1 << node.childCount) - 1);
+}
+
+template <int Width>
+bool WideBoundingVolumeHierarchy<Width>::Intersect(const Ray & ray, HitRecord & outHit) const
+{
+	HitRecord closest;
+	IntersectClosest(ray, closest);
+
+	if (closest.object)
+	{
+		outHit = closest;
+	}
+
+	return closest.object != nullptr;
+}
+
+template <int Width>
+int WideBoundingVolumeHierarchy<Width>::IntersectClosest(const Ray & ray, HitRecord & closest) const
+{
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	const PrecomputedRay precomputed(ray);
+
+	// Pathologically deep trees fall back to a heap-allocated stack
+	StackEntry localStack[StackSize];
+	std::vector<StackEntry> heapStack;
+	StackEntry * stack = localStack;
+
+	if (maxDepth * Width > StackSize)
+	{
+		heapStack.resize(maxDepth * Width);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	int visitedCount = 0;
+	uint32_t current = 0;
+
+	while (true)
+	{
+		const Node & node = nodes[current];
+		visitedCount ++;
+
+		float entries[Lanes];
+		const int hits = IntersectChildren(node, precomputed, closest.t, entries);
+
+		// Sort the children that were hit nearest first
+		int order[Width];
+		int hitCount = 0;
+
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			if (! (hits & (1 << slot)))
+			{
+				continue;
+			}
+
+			int position = hitCount ++;
+
+			while (position > 0 && entries[order[position - 1]] > entries[slot])
+			{
+				order[position] = order[position - 1];
+				-- position;
+			}
+
+			order[position] = slot;
+		}
+
+		// Push the farthest child first so the nearest is visited next
+		for (int i = hitCount - 1; i >= 0; -- i)
+		{
+			stack[stackSize].node = current;
+			stack[stackSize].slot = (uint32_t) order[i];
+			stack[stackSize].entry = entries[order[i]];
+			stackSize ++;
+		}
+
+		// Pop deferred children, intersecting leaves along the way, until reaching the next interior node
+		while (true)
+		{
+			do
+			{
+				if (stackSize == 0)
+				{
+					return visitedCount;
+				}
+
+				-- stackSize;
+			}
+			while (stack[stackSize].entry > closest.t);
+
+			const Node & parent = nodes[stack[stackSize].node];
+			const uint32_t slot = stack[stackSize].slot;
+
+			if (parent.primitiveCount[slot] == 0)
+			{
+				current = parent.offset[slot];
+				break;
+			}
+
+			pools.Intersect(parent.type[slot], parent.offset[slot], parent.primitiveCount[slot], ray, closest);
+			visitedCount ++;
+		}
+	}
+}
+
+template <int Width>
+bool WideBoundingVolumeHierarchy<Width>::IsOccluded(const Ray & ray, const float maxDistance) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	const PrecomputedRay precomputed(ray);
+
+	uint32_t localStack[StackSize];
+	std::vector<uint32_t> heapStack;
+	uint32_t * stack = localStack;
+
+	if (maxDepth * Width > StackSize)
+	{
+		heapStack.resize(maxDepth * Width);
+		stack = heapStack.data();
+	}
+
+	int stackSize = 0;
+	uint32_t current = 0;
+
+	// Any hit before maxDistance will do, so leaves are tested as soon as they are found and children are not ordered
+	while (true)
+	{
+		const Node & node = nodes[current];
+
+		float entries[Lanes];
+		const int hits = IntersectChildren(node, precomputed, maxDistance, entries);
+
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			if (! (hits & (1 << slot)))
+			{
+				continue;
+			}
+
+			if (node.primitiveCount[slot] == 0)
+			{
+				stack[stackSize ++] = node.offset[slot];
+			}
+			else if (pools.IsOccluded(node.type[slot], node.offset[slot], node.primitiveCount[slot], ray, maxDistance))
+			{
+				return true;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return false;
+		}
+
+		current = stack[-- stackSize];
+	}
+}
+
+template <int Width>
+void WideBoundingVolumeHierarchy<Width>::IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const
+{
+	// Wide nodes already spend the SIMD lanes on the children, so rays are traced one at a time
+	for (int i = 0; i < count; ++ i)
+	{
+		outHits[i] = HitRecord();
+		Intersect(rays[i], outHits[i]);
+	}
+}
+
+template <int Width>
+void WideBoundingVolumeHierarchy<Width>::PrintTree(const std::string & name) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- branch (" << (int) nodes[0].childCount << " children)" << std::endl;
+	std::cout << std::endl;
+
+	for (int slot = 0; slot < nodes[0].childCount; ++ slot)
+	{
+		PrintChild(0, slot, name + "->child" + std::to_string(slot));
+	}
+}
+
+template <int Width>
+void WideBoundingVolumeHierarchy<Width>::PrintChild(const uint32_t index, const int slot, const std::string & name) const
+{
+	const Node & node = nodes[index];
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "- min: " << glm::vec3(node.bounds[0][slot], node.bounds[1][slot], node.bounds[2][slot]) << std::endl;
+	std::cout << "- max: " << glm::vec3(node.bounds[3][slot], node.bounds[4][slot], node.bounds[5][slot]) << std::endl;
+
+	if (node.primitiveCount[slot])
+	{
+		std::cout << "- leaf" << std::endl;
+
+		for (uint32_t i = node.offset[slot]; i < node.offset[slot] + node.primitiveCount[slot]; ++ i)
+		{
+			const Object * object = pools.GetObject(node.type[slot], i);
+			std::cout << "- object #" << object->GetID() << " (" << object->GetObjectType() << ")" << std::endl;
+		}
+
+		std::cout << std::endl;
+	}
+	else
+	{
+		const Node & child = nodes[node.offset[slot]];
+
+		std::cout << "- branch (" << (int) child.childCount << " children)" << std::endl;
+		std::cout << std::endl;
+
+		for (int childSlot = 0; childSlot < child.childCount; ++ childSlot)
+		{
+			PrintChild(node.offset[slot], childSlot, name + "->child" + std::to_string(childSlot));
+		}
+	}
+}
+
+template <int Width>
+AABB WideBoundingVolumeHierarchy<Width>::GetChildBox(const Node & node, const int slot) const
+{
+	return AABB(
+		glm::vec3(node.bounds[0][slot], node.bounds[1][slot], node.bounds[2][slot]),
+		glm::vec3(node.bounds[3][slot], node.bounds[4][slot], node.bounds[5][slot]));
+}
+
+template <int Width>
+float WideBoundingVolumeHierarchy<Width>::GetSAHCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.f;
+	}
+
+	AABB rootBox;
+	for (int slot = 0; slot < nodes[0].childCount; ++ slot)
+	{
+		rootBox.AddBox(GetChildBox(nodes[0], slot));
+	}
+
+	const float rootArea = rootBox.GetSurfaceArea();
+
+	// Every ray visits the root, and every other node is the child in one slot of its parent
+	float cost = TraversalCost;
+
+	for (const Node & node : nodes)
+	{
+		for (int slot = 0; slot < node.childCount; ++ slot)
+		{
+			const float probability = rootArea > 0 ? GetChildBox(node, slot).GetSurfaceArea() / rootArea : 1.f;
+			cost += probability * (node.primitiveCount[slot] ? (float) node.primitiveCount[slot] : TraversalCost);
+		}
+	}
+
+	return cost;
+}
+
+template <int Width>
+SpatialDataStructure::Statistics WideBoundingVolumeHierarchy<Width>::GetStatistics() const
+{
+	Statistics statistics;
+
+	if (nodes.size())
+	{
+		GatherStatistics(0, 1, statistics);
+	}
+
+	statistics.sahCost = GetSAHCost();
+	statistics.nodeBytes = nodes.size() * sizeof(Node);
+	statistics.primitiveBytes = pools.GetMemoryUsage();
+	return statistics;
+}
+
+template <int Width>
+void WideBoundingVolumeHierarchy<Width>::GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const
+{
+	const Node & node = nodes[index];
+
+	AABB childBoxes[Width];
+	for (int slot = 0; slot < node.childCount; ++ slot)
+	{
+		childBoxes[slot] = GetChildBox(node, slot);
+	}
+
+	statistics.AddInterior(childBoxes, node.childCount);
+
+	for (int slot = 0; slot < node.childCount; ++ slot)
+	{
+		if (node.primitiveCount[slot])
+		{
+			statistics.AddLeaf(depth + 1, node.primitiveCount[slot]);
+		}
+		else
+		{
+			GatherStatistics(node.offset[slot], depth + 1, statistics);
+		}
+	}
+}
+
+template <int Width>
+int WideBoundingVolumeHierarchy<Width>::CountVisitedNodes(const Ray & ray) const
+{
+	HitRecord closest;
+	return IntersectClosest(ray, closest);
+}
+
+template <int Width>
+const NodeArray<typename WideBoundingVolumeHierarchy<Width>::Node> & WideBoundingVolumeHierarchy<Width>::GetNodes() const
+{
+	return nodes;
+}
+
+template <int Width>
+const PrimitivePools & WideBoundingVolumeHierarchy<Width>::GetPools() const
+{
+	return pools;
+}
+
+template <int Width>
+int WideBoundingVolumeHierarchy<Width>::GetMaxDepth() const
+{
+	return maxDepth;
+}
+
+template class WideBoundingVolumeHierarchy<4>;
+template class WideBoundingVolumeHierarchy<8>;
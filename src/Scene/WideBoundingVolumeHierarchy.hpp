@@ -0,0 +1,90 @@
+// Copyright (C) 2018 Ian Dunn
+// For conditions of distribution and use, see the LICENSE file
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "FlatBoundingVolumeHierarchy.hpp"
+#include "PrimitivePools.hpp"
+#include "SpatialDataStructure.hpp"
+#include "NodeArray.hpp"
+
+#include <RayTracer/Simd.hpp>
+#include <RayTracer/MappedFile.hpp>
+
+
+// A binary hierarchy collapsed into nodes with up to Width children each.
+// A node stores the bounds of all its children one component per array,
+// so a single SIMD slab test covers every child at once.
+template <int Width>
+class WideBoundingVolumeHierarchy : public SpatialDataStructure
+{
+
+public:
+
+	// Nodes narrower than the SIMD width are padded with empty children
+	static const int Lanes = Width < SimdWidth ? SimdWidth : Width;
+
+	struct Node
+	{
+		// Child bounds, indexed by axis for the minimum and by axis + 3 for the maximum
+		float bounds[6][Lanes];
+
+		// Interior children: index of the child node. Leaf children: index of the first primitive in the pool for the leaf's type.
+		uint32_t offset[Width];
+
+		// Zero for interior children
+		uint16_t primitiveCount[Width];
+
+		PrimitivePools::Type type[Width];
+		uint8_t childCount = 0;
+	};
+
+	WideBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy & binary);
+
+	// Uses nodes that live in a mapped file, taking ownership of the file
+	WideBoundingVolumeHierarchy(MappedFile * file, Node * nodes, const uint32_t nodeCount, const PrimitivePools & pools, const int maxDepth);
+	~WideBoundingVolumeHierarchy();
+
+	bool Intersect(const Ray & ray, HitRecord & outHit) const;
+	bool IsOccluded(const Ray & ray, const float maxDistance) const;
+	void IntersectPacket(const Ray * rays, const int count, HitRecord * outHits) const;
+	void PrintTree(const std::string & name) const;
+	float GetSAHCost() const;
+	Statistics GetStatistics() const;
+	int CountVisitedNodes(const Ray & ray) const;
+
+	const NodeArray<Node> & GetNodes() const;
+	const PrimitivePools & GetPools() const;
+	int GetMaxDepth() const;
+
+protected:
+
+	static const int StackSize = 256;
+
+	struct StackEntry
+	{
+		uint32_t node;
+		uint32_t slot;
+		float entry;
+	};
+
+	uint32_t Collapse(const NodeArray<FlatBoundingVolumeHierarchy::Node> & binaryNodes, const uint32_t binaryIndex, const int depth);
+	int IntersectChildren(const Node & node, const PrecomputedRay & ray, const float tMax, float * outEntries) const;
+
+	// Returns the number of nodes visited, counting each leaf child as a node
+	int IntersectClosest(const Ray & ray, HitRecord & closest) const;
+	void PrintChild(const uint32_t index, const int slot, const std::string & name) const;
+	AABB GetChildBox(const Node & node, const int slot) const;
+	void GatherStatistics(const uint32_t index, const int depth, Statistics & statistics) const;
+
+	NodeArray<Node> nodes;
+	PrimitivePools pools;
+	int maxDepth = 0;
+	MappedFile * mappedFile = nullptr;
+
+};